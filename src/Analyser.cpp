@@ -13,6 +13,16 @@ std::vector<std::unique_ptr<Stmt>> Analyser::analyse(std::vector<std::unique_ptr
     declareVariable("print", Variable{std::make_shared<FunctionType>(NOTHING_TYPE, std::vector<Type>{DYNAMIC_TYPE}), true});
     declareVariable("put", Variable{std::make_shared<FunctionType>(NOTHING_TYPE, std::vector<Type>{DYNAMIC_TYPE}), true});
     declareVariable("dis", Variable{std::make_shared<FunctionType>(STRING_TYPE, std::vector<Type>{DYNAMIC_TYPE}), true});
+    declareVariable("gcStats", Variable{std::make_shared<FunctionType>(STRING_TYPE, std::vector<Type>{}), true});
+    declareVariable("sum", Variable{std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE}), true});
+    declareVariable("min", Variable{std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE}), true});
+    declareVariable("max", Variable{std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE}), true});
+    declareVariable("dot", Variable{std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}), true});
+    declareVariable("add", Variable{std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}), true});
+    declareVariable("mul", Variable{std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}), true});
+    declareVariable("fill", Variable{std::make_shared<FunctionType>(NOTHING_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}), true});
+    declareVariable("indexOf", Variable{std::make_shared<FunctionType>(INT_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}), true});
+    declareVariable("count", Variable{std::make_shared<FunctionType>(INT_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}), true});
 
     for (auto &stmt : program) {
         analyse(*stmt);
@@ -351,7 +361,9 @@ void Analyser::visitAllotExpr(AllotExpr& expr) {
     analyse(*expr.target);
     analyse(*expr.value);
 
-    if (!expr.target->getType()->looselyEquals(*expr.value->getType())) {
+    // Array elements follow the same rule as CHECK_ALLOTABLE does at runtime: ints can go into arrays of
+    // floats, but floats can't go into arrays of ints.
+    if (!expr.value->getType()->looselyEquals(*expr.target->getType())) {
         throw errorAt(expr.oper, "Cannot assign variable of type '" + expr.target->getType()->toString() +
                                  "' with value of type '" + expr.value->getType()->toString() + "'.");
     }
@@ -372,7 +384,7 @@ void Analyser::visitArrayExpr(ArrayExpr &expr) {
         Type elementType = lookUpType(*expr.typeName);
 
         for (Type &type : elementTypes) {
-            if (!elementType->looselyEquals(*type)) {
+            if (!type->looselyEquals(*elementType)) {
                 throw errorAt(expr.square, "Array literal of specified type '" + elementType->toString() +
                                            "' cannot contain an element of type '" + type->toString() + "'.");
             }
@@ -382,13 +394,17 @@ void Analyser::visitArrayExpr(ArrayExpr &expr) {
     } else {
         Type elementType = (elementTypes.empty() ? m_types["any"] : elementTypes[0]);
 
-        for (int i = 1; i < elementTypes.size(); ++i) {
-            if (*elementTypes[i] != *elementTypes[i - 1]) {
-                expr.setType(std::make_shared<ArrayType>(m_types["any"]));
-                break;
+        for (size_t i = 1; i < elementTypes.size(); ++i) {
+            if (*elementTypes[i] == *elementType) continue;
+
+            // Ints and floats mix into an array of floats, which holds every one of them unchanged.
+            if (elementTypes[i]->isNumeric() && elementType->isNumeric()) {
+                elementType = m_types["float"];
+                continue;
             }
 
-            elementType = elementTypes[i];
+            elementType = m_types["any"];
+            break;
         }
 
         expr.setType(std::make_shared<ArrayType>(elementType));
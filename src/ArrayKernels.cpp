@@ -0,0 +1,669 @@
+#include "h/ArrayKernels.h"
+#include "h/common.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <limits>
+
+#ifdef ENACT_SIMD_ENABLED
+#include <immintrin.h>
+
+// Kernels with this attribute may only run once the CPU is known to support AVX2.
+#define ENACT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Floats are added up in this many partial sums, element i going to sum i % FLOAT_LANES, which are then added
+// together pairwise. Every kernel does the same, so floats are rounded the same way whichever one runs.
+constexpr size_t FLOAT_LANES = 8;
+
+// Ints wrap around instead of overflowing, like they do in bytecode.
+static int32_t wrappingAdd(int32_t left, int32_t right) {
+    return static_cast<int32_t>(static_cast<uint32_t>(left) + static_cast<uint32_t>(right));
+}
+
+static int32_t wrappingMultiply(int32_t left, int32_t right) {
+    return static_cast<int32_t>(static_cast<uint32_t>(left) * static_cast<uint32_t>(right));
+}
+
+static double addLanes(const double (&lanes)[FLOAT_LANES]) {
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+static double minOf(double left, double right) {
+    if (std::isnan(left) || std::isnan(right)) return std::numeric_limits<double>::quiet_NaN();
+    return right < left ? right : left;
+}
+
+static double maxOf(double left, double right) {
+    if (std::isnan(left) || std::isnan(right)) return std::numeric_limits<double>::quiet_NaN();
+    return right > left ? right : left;
+}
+
+// The plain loops. The vector kernels use them for the elements that don't fill a whole vector.
+
+static int32_t sumScalar(const int32_t* data, size_t length) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < length; ++i) sum = wrappingAdd(sum, data[i]);
+    return sum;
+}
+
+// Adds the elements from begin onwards to the sum of the whole lanes before them.
+static double sumRemaining(double sum, const double* data, size_t begin, size_t length) {
+    for (size_t i = begin; i < length; ++i) sum += data[i];
+    return sum;
+}
+
+// The vector kernels add up floats in the same order, but only call sumRemaining.
+[[maybe_unused]] static double sumScalar(const double* data, size_t length) {
+    double lanes[FLOAT_LANES]{};
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= length; i += FLOAT_LANES) {
+        for (size_t lane = 0; lane < FLOAT_LANES; ++lane) lanes[lane] += data[i + lane];
+    }
+    return sumRemaining(addLanes(lanes), data, i, length);
+}
+
+static int32_t minScalar(const int32_t* data, size_t length) {
+    int32_t min = data[0];
+    for (size_t i = 1; i < length; ++i) min = data[i] < min ? data[i] : min;
+    return min;
+}
+
+static int32_t maxScalar(const int32_t* data, size_t length) {
+    int32_t max = data[0];
+    for (size_t i = 1; i < length; ++i) max = data[i] > max ? data[i] : max;
+    return max;
+}
+
+static double minScalar(const double* data, size_t length) {
+    double min = data[0];
+    for (size_t i = 1; i < length; ++i) min = minOf(min, data[i]);
+    return min;
+}
+
+static double maxScalar(const double* data, size_t length) {
+    double max = data[0];
+    for (size_t i = 1; i < length; ++i) max = maxOf(max, data[i]);
+    return max;
+}
+
+static int32_t dotScalar(const int32_t* left, const int32_t* right, size_t length) {
+    int32_t dot = 0;
+    for (size_t i = 0; i < length; ++i) dot = wrappingAdd(dot, wrappingMultiply(left[i], right[i]));
+    return dot;
+}
+
+static double dotRemaining(double dot, const double* left, const double* right, size_t begin, size_t length) {
+    for (size_t i = begin; i < length; ++i) dot += left[i] * right[i];
+    return dot;
+}
+
+[[maybe_unused]] static double dotScalar(const double* left, const double* right, size_t length) {
+    double lanes[FLOAT_LANES]{};
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= length; i += FLOAT_LANES) {
+        for (size_t lane = 0; lane < FLOAT_LANES; ++lane) lanes[lane] += left[i + lane] * right[i + lane];
+    }
+    return dotRemaining(addLanes(lanes), left, right, i, length);
+}
+
+static void addScalar(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    for (size_t i = 0; i < length; ++i) result[i] = wrappingAdd(left[i], right[i]);
+}
+
+static void addScalar(const double* left, const double* right, double* result, size_t length) {
+    for (size_t i = 0; i < length; ++i) result[i] = left[i] + right[i];
+}
+
+static void multiplyScalar(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    for (size_t i = 0; i < length; ++i) result[i] = wrappingMultiply(left[i], right[i]);
+}
+
+static void multiplyScalar(const double* left, const double* right, double* result, size_t length) {
+    for (size_t i = 0; i < length; ++i) result[i] = left[i] * right[i];
+}
+
+template <typename T>
+static size_t indexOfScalar(const T* data, size_t length, T value) {
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] == value) return i;
+    }
+    return length;
+}
+
+template <typename T>
+static size_t countScalar(const T* data, size_t length, T value) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; ++i) count += data[i] == value;
+    return count;
+}
+
+#ifdef ENACT_SIMD_ENABLED
+
+// SSE2 has no 32-bit min, max or low multiply, so they are put together from what it does have.
+
+static inline __m128i minSSE2(__m128i left, __m128i right) {
+    __m128i greater = _mm_cmpgt_epi32(left, right);
+    return _mm_or_si128(_mm_and_si128(greater, right), _mm_andnot_si128(greater, left));
+}
+
+static inline __m128i maxSSE2(__m128i left, __m128i right) {
+    __m128i greater = _mm_cmpgt_epi32(left, right);
+    return _mm_or_si128(_mm_and_si128(greater, left), _mm_andnot_si128(greater, right));
+}
+
+static inline __m128i multiplySSE2(__m128i left, __m128i right) {
+    __m128i even = _mm_mul_epu32(left, right);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(left, 32), _mm_srli_epi64(right, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i loadSSE2(const int32_t* data) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+static inline void storeSSE2(int32_t* data, __m128i vector) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(data), vector);
+}
+
+static int32_t sumSSE2(const int32_t* data, size_t length) {
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) sum = _mm_add_epi32(sum, loadSSE2(data + i));
+
+    int32_t lanes[4];
+    storeSSE2(lanes, sum);
+    return wrappingAdd(sumScalar(lanes, 4), sumScalar(data + i, length - i));
+}
+
+static double sumSSE2(const double* data, size_t length) {
+    __m128d sums[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= length; i += FLOAT_LANES) {
+        for (size_t j = 0; j < 4; ++j) sums[j] = _mm_add_pd(sums[j], _mm_loadu_pd(data + i + 2 * j));
+    }
+
+    double lanes[FLOAT_LANES];
+    for (size_t j = 0; j < 4; ++j) _mm_storeu_pd(lanes + 2 * j, sums[j]);
+    return sumRemaining(addLanes(lanes), data, i, length);
+}
+
+static int32_t minSSE2(const int32_t* data, size_t length) {
+    if (length < 4) return minScalar(data, length);
+
+    __m128i min = loadSSE2(data);
+    size_t i = 4;
+    for (; i + 4 <= length; i += 4) min = minSSE2(min, loadSSE2(data + i));
+
+    int32_t lanes[4];
+    storeSSE2(lanes, min);
+    int32_t result = minScalar(lanes, 4);
+    return i < length ? std::min(result, minScalar(data + i, length - i)) : result;
+}
+
+static int32_t maxSSE2(const int32_t* data, size_t length) {
+    if (length < 4) return maxScalar(data, length);
+
+    __m128i max = loadSSE2(data);
+    size_t i = 4;
+    for (; i + 4 <= length; i += 4) max = maxSSE2(max, loadSSE2(data + i));
+
+    int32_t lanes[4];
+    storeSSE2(lanes, max);
+    int32_t result = maxScalar(lanes, 4);
+    return i < length ? std::max(result, maxScalar(data + i, length - i)) : result;
+}
+
+// Float minimums and maximums keep track of NaNs on the side, since minpd and maxpd ignore them when they come
+// second.
+static double minSSE2(const double* data, size_t length) {
+    if (length < 2) return minScalar(data, length);
+
+    __m128d min = _mm_loadu_pd(data);
+    __m128d nan = _mm_cmpunord_pd(min, min);
+    size_t i = 2;
+    for (; i + 2 <= length; i += 2) {
+        __m128d next = _mm_loadu_pd(data + i);
+        min = _mm_min_pd(min, next);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(next, next));
+    }
+
+    if (_mm_movemask_pd(nan) != 0) return std::numeric_limits<double>::quiet_NaN();
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, min);
+    double result = minOf(lanes[0], lanes[1]);
+    return i < length ? minOf(result, data[i]) : result;
+}
+
+static double maxSSE2(const double* data, size_t length) {
+    if (length < 2) return maxScalar(data, length);
+
+    __m128d max = _mm_loadu_pd(data);
+    __m128d nan = _mm_cmpunord_pd(max, max);
+    size_t i = 2;
+    for (; i + 2 <= length; i += 2) {
+        __m128d next = _mm_loadu_pd(data + i);
+        max = _mm_max_pd(max, next);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(next, next));
+    }
+
+    if (_mm_movemask_pd(nan) != 0) return std::numeric_limits<double>::quiet_NaN();
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, max);
+    double result = maxOf(lanes[0], lanes[1]);
+    return i < length ? maxOf(result, data[i]) : result;
+}
+
+static int32_t dotSSE2(const int32_t* left, const int32_t* right, size_t length) {
+    __m128i dot = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) dot = _mm_add_epi32(dot, multiplySSE2(loadSSE2(left + i), loadSSE2(right + i)));
+
+    int32_t lanes[4];
+    storeSSE2(lanes, dot);
+    return wrappingAdd(sumScalar(lanes, 4), dotScalar(left + i, right + i, length - i));
+}
+
+static double dotSSE2(const double* left, const double* right, size_t length) {
+    __m128d dots[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= length; i += FLOAT_LANES) {
+        for (size_t j = 0; j < 4; ++j) {
+            __m128d product = _mm_mul_pd(_mm_loadu_pd(left + i + 2 * j), _mm_loadu_pd(right + i + 2 * j));
+            dots[j] = _mm_add_pd(dots[j], product);
+        }
+    }
+
+    double lanes[FLOAT_LANES];
+    for (size_t j = 0; j < 4; ++j) _mm_storeu_pd(lanes + 2 * j, dots[j]);
+    return dotRemaining(addLanes(lanes), left, right, i, length);
+}
+
+static void addSSE2(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) storeSSE2(result + i, _mm_add_epi32(loadSSE2(left + i), loadSSE2(right + i)));
+    addScalar(left + i, right + i, result + i, length - i);
+}
+
+static void addSSE2(const double* left, const double* right, double* result, size_t length) {
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        _mm_storeu_pd(result + i, _mm_add_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+    }
+    addScalar(left + i, right + i, result + i, length - i);
+}
+
+static void multiplySSE2(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) storeSSE2(result + i, multiplySSE2(loadSSE2(left + i), loadSSE2(right + i)));
+    multiplyScalar(left + i, right + i, result + i, length - i);
+}
+
+static void multiplySSE2(const double* left, const double* right, double* result, size_t length) {
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        _mm_storeu_pd(result + i, _mm_mul_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+    }
+    multiplyScalar(left + i, right + i, result + i, length - i);
+}
+
+static size_t indexOfSSE2(const int32_t* data, size_t length, int32_t value) {
+    __m128i needle = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        int matches = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(loadSSE2(data + i), needle)));
+        if (matches != 0) return i + __builtin_ctz(matches);
+    }
+    return i + indexOfScalar(data + i, length - i, value);
+}
+
+static size_t indexOfSSE2(const double* data, size_t length, double value) {
+    __m128d needle = _mm_set1_pd(value);
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        int matches = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(data + i), needle));
+        if (matches != 0) return i + __builtin_ctz(matches);
+    }
+    return i + indexOfScalar(data + i, length - i, value);
+}
+
+static size_t countSSE2(const int32_t* data, size_t length, int32_t value) {
+    __m128i needle = _mm_set1_epi32(value);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(loadSSE2(data + i), needle))));
+    }
+    return count + countScalar(data + i, length - i, value);
+}
+
+static size_t countSSE2(const double* data, size_t length, double value) {
+    __m128d needle = _mm_set1_pd(value);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        count += __builtin_popcount(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(data + i), needle)));
+    }
+    return count + countScalar(data + i, length - i, value);
+}
+
+ENACT_TARGET_AVX2 static inline __m256i loadAVX2(const int32_t* data) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+}
+
+ENACT_TARGET_AVX2 static inline void storeAVX2(int32_t* data, __m256i vector) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), vector);
+}
+
+ENACT_TARGET_AVX2 static int32_t sumAVX2(const int32_t* data, size_t length) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) sum = _mm256_add_epi32(sum, loadAVX2(data + i));
+
+    int32_t lanes[8];
+    storeAVX2(lanes, sum);
+    return wrappingAdd(sumScalar(lanes, 8), sumScalar(data + i, length - i));
+}
+
+ENACT_TARGET_AVX2 static double sumAVX2(const double* data, size_t length) {
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= length; i += FLOAT_LANES) {
+        low = _mm256_add_pd(low, _mm256_loadu_pd(data + i));
+        high = _mm256_add_pd(high, _mm256_loadu_pd(data + i + 4));
+    }
+
+    double lanes[FLOAT_LANES];
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+    return sumRemaining(addLanes(lanes), data, i, length);
+}
+
+ENACT_TARGET_AVX2 static int32_t minAVX2(const int32_t* data, size_t length) {
+    if (length < 8) return minScalar(data, length);
+
+    __m256i min = loadAVX2(data);
+    size_t i = 8;
+    for (; i + 8 <= length; i += 8) min = _mm256_min_epi32(min, loadAVX2(data + i));
+
+    int32_t lanes[8];
+    storeAVX2(lanes, min);
+    int32_t result = minScalar(lanes, 8);
+    return i < length ? std::min(result, minScalar(data + i, length - i)) : result;
+}
+
+ENACT_TARGET_AVX2 static int32_t maxAVX2(const int32_t* data, size_t length) {
+    if (length < 8) return maxScalar(data, length);
+
+    __m256i max = loadAVX2(data);
+    size_t i = 8;
+    for (; i + 8 <= length; i += 8) max = _mm256_max_epi32(max, loadAVX2(data + i));
+
+    int32_t lanes[8];
+    storeAVX2(lanes, max);
+    int32_t result = maxScalar(lanes, 8);
+    return i < length ? std::max(result, maxScalar(data + i, length - i)) : result;
+}
+
+ENACT_TARGET_AVX2 static double minAVX2(const double* data, size_t length) {
+    if (length < 4) return minScalar(data, length);
+
+    __m256d min = _mm256_loadu_pd(data);
+    __m256d nan = _mm256_cmp_pd(min, min, _CMP_UNORD_Q);
+    size_t i = 4;
+    for (; i + 4 <= length; i += 4) {
+        __m256d next = _mm256_loadu_pd(data + i);
+        min = _mm256_min_pd(min, next);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(next, next, _CMP_UNORD_Q));
+    }
+
+    if (_mm256_movemask_pd(nan) != 0) return std::numeric_limits<double>::quiet_NaN();
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, min);
+    double result = minScalar(lanes, 4);
+    return i < length ? minOf(result, minScalar(data + i, length - i)) : result;
+}
+
+ENACT_TARGET_AVX2 static double maxAVX2(const double* data, size_t length) {
+    if (length < 4) return maxScalar(data, length);
+
+    __m256d max = _mm256_loadu_pd(data);
+    __m256d nan = _mm256_cmp_pd(max, max, _CMP_UNORD_Q);
+    size_t i = 4;
+    for (; i + 4 <= length; i += 4) {
+        __m256d next = _mm256_loadu_pd(data + i);
+        max = _mm256_max_pd(max, next);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(next, next, _CMP_UNORD_Q));
+    }
+
+    if (_mm256_movemask_pd(nan) != 0) return std::numeric_limits<double>::quiet_NaN();
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, max);
+    double result = maxScalar(lanes, 4);
+    return i < length ? maxOf(result, maxScalar(data + i, length - i)) : result;
+}
+
+ENACT_TARGET_AVX2 static int32_t dotAVX2(const int32_t* left, const int32_t* right, size_t length) {
+    __m256i dot = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        dot = _mm256_add_epi32(dot, _mm256_mullo_epi32(loadAVX2(left + i), loadAVX2(right + i)));
+    }
+
+    int32_t lanes[8];
+    storeAVX2(lanes, dot);
+    return wrappingAdd(sumScalar(lanes, 8), dotScalar(left + i, right + i, length - i));
+}
+
+// Multiplies and adds separately, since a fused multiply-add would round differently from the other kernels.
+ENACT_TARGET_AVX2 static double dotAVX2(const double* left, const double* right, size_t length) {
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + FLOAT_LANES <= length; i += FLOAT_LANES) {
+        low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+        high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(left + i + 4), _mm256_loadu_pd(right + i + 4)));
+    }
+
+    double lanes[FLOAT_LANES];
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+    return dotRemaining(addLanes(lanes), left, right, i, length);
+}
+
+ENACT_TARGET_AVX2 static void addAVX2(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) storeAVX2(result + i, _mm256_add_epi32(loadAVX2(left + i), loadAVX2(right + i)));
+    addScalar(left + i, right + i, result + i, length - i);
+}
+
+ENACT_TARGET_AVX2 static void addAVX2(const double* left, const double* right, double* result, size_t length) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        _mm256_storeu_pd(result + i, _mm256_add_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+    }
+    addScalar(left + i, right + i, result + i, length - i);
+}
+
+ENACT_TARGET_AVX2 static void multiplyAVX2(const int32_t* left, const int32_t* right, int32_t* result,
+                                           size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        storeAVX2(result + i, _mm256_mullo_epi32(loadAVX2(left + i), loadAVX2(right + i)));
+    }
+    multiplyScalar(left + i, right + i, result + i, length - i);
+}
+
+ENACT_TARGET_AVX2 static void multiplyAVX2(const double* left, const double* right, double* result, size_t length) {
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        _mm256_storeu_pd(result + i, _mm256_mul_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+    }
+    multiplyScalar(left + i, right + i, result + i, length - i);
+}
+
+ENACT_TARGET_AVX2 static size_t indexOfAVX2(const int32_t* data, size_t length, int32_t value) {
+    __m256i needle = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        int matches = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(loadAVX2(data + i), needle)));
+        if (matches != 0) return i + __builtin_ctz(matches);
+    }
+    return i + indexOfScalar(data + i, length - i, value);
+}
+
+ENACT_TARGET_AVX2 static size_t indexOfAVX2(const double* data, size_t length, double value) {
+    __m256d needle = _mm256_set1_pd(value);
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        int matches = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(data + i), needle, _CMP_EQ_OQ));
+        if (matches != 0) return i + __builtin_ctz(matches);
+    }
+    return i + indexOfScalar(data + i, length - i, value);
+}
+
+ENACT_TARGET_AVX2 static size_t countAVX2(const int32_t* data, size_t length, int32_t value) {
+    __m256i needle = _mm256_set1_epi32(value);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m256i matches = _mm256_cmpeq_epi32(loadAVX2(data + i), needle);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(matches)));
+    }
+    return count + countScalar(data + i, length - i, value);
+}
+
+ENACT_TARGET_AVX2 static size_t countAVX2(const double* data, size_t length, double value) {
+    __m256d needle = _mm256_set1_pd(value);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m256d matches = _mm256_cmp_pd(_mm256_loadu_pd(data + i), needle, _CMP_EQ_OQ);
+        count += __builtin_popcount(_mm256_movemask_pd(matches));
+    }
+    return count + countScalar(data + i, length - i, value);
+}
+
+enum class InstructionSet {
+    SSE2,
+    AVX2,
+};
+
+// Every x86-64 CPU has SSE2.
+static InstructionSet detectInstructionSet() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? InstructionSet::AVX2 : InstructionSet::SSE2;
+}
+
+static const InstructionSet instructionSet = detectInstructionSet();
+
+// Calls the kernel for the instruction set that was picked.
+#define DISPATCH_KERNEL(name, ...) \
+    switch (instructionSet) { \
+        case InstructionSet::AVX2: return name##AVX2(__VA_ARGS__); \
+        case InstructionSet::SSE2: break; \
+    } \
+    return name##SSE2(__VA_ARGS__)
+
+#else
+
+#define DISPATCH_KERNEL(name, ...) return name##Scalar(__VA_ARGS__)
+
+#endif
+
+int32_t ArrayKernels::sum(const int32_t* data, size_t length) {
+    DISPATCH_KERNEL(sum, data, length);
+}
+
+double ArrayKernels::sum(const double* data, size_t length) {
+    DISPATCH_KERNEL(sum, data, length);
+}
+
+int32_t ArrayKernels::min(const int32_t* data, size_t length) {
+    DISPATCH_KERNEL(min, data, length);
+}
+
+double ArrayKernels::min(const double* data, size_t length) {
+    DISPATCH_KERNEL(min, data, length);
+}
+
+int32_t ArrayKernels::max(const int32_t* data, size_t length) {
+    DISPATCH_KERNEL(max, data, length);
+}
+
+double ArrayKernels::max(const double* data, size_t length) {
+    DISPATCH_KERNEL(max, data, length);
+}
+
+int32_t ArrayKernels::dot(const int32_t* left, const int32_t* right, size_t length) {
+    DISPATCH_KERNEL(dot, left, right, length);
+}
+
+double ArrayKernels::dot(const double* left, const double* right, size_t length) {
+    DISPATCH_KERNEL(dot, left, right, length);
+}
+
+void ArrayKernels::add(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    DISPATCH_KERNEL(add, left, right, result, length);
+}
+
+void ArrayKernels::add(const double* left, const double* right, double* result, size_t length) {
+    DISPATCH_KERNEL(add, left, right, result, length);
+}
+
+void ArrayKernels::multiply(const int32_t* left, const int32_t* right, int32_t* result, size_t length) {
+    DISPATCH_KERNEL(multiply, left, right, result, length);
+}
+
+void ArrayKernels::multiply(const double* left, const double* right, double* result, size_t length) {
+    DISPATCH_KERNEL(multiply, left, right, result, length);
+}
+
+size_t ArrayKernels::indexOf(const int32_t* data, size_t length, int32_t value) {
+    DISPATCH_KERNEL(indexOf, data, length, value);
+}
+
+size_t ArrayKernels::indexOf(const double* data, size_t length, double value) {
+    DISPATCH_KERNEL(indexOf, data, length, value);
+}
+
+size_t ArrayKernels::count(const int32_t* data, size_t length, int32_t value) {
+    DISPATCH_KERNEL(count, data, length, value);
+}
+
+size_t ArrayKernels::count(const double* data, size_t length, double value) {
+    DISPATCH_KERNEL(count, data, length, value);
+}
+
+#undef DISPATCH_KERNEL
+
+// Bools are already 64 to a word, so they are looked at a word at a time on every CPU.
+
+size_t ArrayKernels::indexOf(const uint64_t* words, size_t length, bool value) {
+    for (size_t i = 0; i * 64 < length; ++i) {
+        std::bitset<64> bits{value ? words[i] : ~words[i]};
+        if (bits.none()) continue;
+
+        size_t bit = 0;
+        while (!bits.test(bit)) ++bit;
+
+        // Looking for false finds the zeros past the end, too.
+        return std::min(i * 64 + bit, length);
+    }
+    return length;
+}
+
+size_t ArrayKernels::count(const uint64_t* words, size_t length, bool value) {
+    size_t ones = 0;
+    for (size_t i = 0; i * 64 < length; ++i) {
+        ones += std::bitset<64>{words[i]}.count();
+    }
+    return value ? ones : length - ones;
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 #include <strings.h>
@@ -6,7 +7,10 @@
 
 void Chunk::write(uint8_t byte, line_t line) {
     m_code.push_back(byte);
-    m_lines.insert(std::pair(m_code.size() - 1, line));
+
+    if (m_lines.empty() || m_lines.back().line != line) {
+        m_lines.push_back(LineStart{m_code.size() - 1, line});
+    }
 }
 
 void Chunk::write(OpCode byte, line_t line) {
@@ -88,6 +92,7 @@ std::pair<std::string, size_t> Chunk::disassembleInstruction(size_t index) const
         case OpCode::NIL:
         case OpCode::CHECK_INT:
         case OpCode::CHECK_NUMERIC:
+        case OpCode::CHECK_STRING:
         case OpCode::CHECK_BOOL:
         case OpCode::CHECK_REFERENCE:
         case OpCode::CHECK_INDEXABLE:
@@ -102,6 +107,33 @@ std::pair<std::string, size_t> Chunk::disassembleInstruction(size_t index) const
         case OpCode::LESS:
         case OpCode::GREATER:
         case OpCode::EQUAL:
+        case OpCode::CONCATENATE:
+        case OpCode::ADD_INT:
+        case OpCode::SUBTRACT_INT:
+        case OpCode::MULTIPLY_INT:
+        case OpCode::DIVIDE_INT:
+        case OpCode::LESS_INT:
+        case OpCode::GREATER_INT:
+        case OpCode::LESS_EQUAL_INT:
+        case OpCode::GREATER_EQUAL_INT:
+        case OpCode::ADD_FLOAT:
+        case OpCode::SUBTRACT_FLOAT:
+        case OpCode::MULTIPLY_FLOAT:
+        case OpCode::DIVIDE_FLOAT:
+        case OpCode::LESS_FLOAT:
+        case OpCode::GREATER_FLOAT:
+        case OpCode::ADD_INT_QUICK:
+        case OpCode::SUBTRACT_INT_QUICK:
+        case OpCode::MULTIPLY_INT_QUICK:
+        case OpCode::DIVIDE_INT_QUICK:
+        case OpCode::LESS_INT_QUICK:
+        case OpCode::GREATER_INT_QUICK:
+        case OpCode::ADD_FLOAT_QUICK:
+        case OpCode::SUBTRACT_FLOAT_QUICK:
+        case OpCode::MULTIPLY_FLOAT_QUICK:
+        case OpCode::DIVIDE_FLOAT_QUICK:
+        case OpCode::LESS_FLOAT_QUICK:
+        case OpCode::GREATER_FLOAT_QUICK:
         case OpCode::GET_ARRAY_INDEX:
         case OpCode::SET_ARRAY_INDEX:
         case OpCode::POP:
@@ -120,7 +152,8 @@ std::pair<std::string, size_t> Chunk::disassembleInstruction(size_t index) const
         case OpCode::SET_LOCAL:
         case OpCode::GET_UPVALUE:
         case OpCode::SET_UPVALUE:
-        case OpCode::CALL: {
+        case OpCode::CALL:
+        case OpCode::INC_LOCAL: {
             std::string str;
             std::tie(str, index) = disassembleByte(index);
             s << str;
@@ -168,6 +201,16 @@ std::pair<std::string, size_t> Chunk::disassembleInstruction(size_t index) const
             break;
         }
 
+        // Local and constant instructions
+        case OpCode::ADD_LOCAL_CONSTANT:
+        case OpCode::SUBTRACT_LOCAL_CONSTANT:
+        case OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE: {
+            std::string str;
+            std::tie(str, index) = disassembleLocalConstant(index);
+            s << str;
+            break;
+        }
+
         // Closure instructions
         case OpCode::CLOSURE: {
             std::ios_base::fmtflags f( s.flags() );
@@ -319,27 +362,222 @@ std::pair<std::string, size_t> Chunk::disassembleLongConstant(size_t index) cons
     return {s.str(), ++index};
 }
 
-line_t Chunk::getLine(size_t index) const {
-    line_t line = 0;
+std::pair<std::string, size_t> Chunk::disassembleLocalConstant(size_t index) const {
+    std::stringstream s;
+    std::ios_base::fmtflags f( s.flags() );
+
+    auto op = static_cast<OpCode>(m_code[index]);
+    s << std::left << std::setw(16) << opCodeToString(op);
+    s.flags(f);
 
-    while (index >= 0 && m_lines.count(index) <= 0) {
-        --index;
+    size_t slot = m_code[index + 1];
+    size_t constant = m_code[index + 2];
+    index += 2;
+
+    s << " " << slot << " " << constant << " (";
+    s << m_constants[constant] << ")";
+
+    if (op == OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE) {
+        uint16_t jump = m_code[index + 1] | (m_code[index + 2] << 8);
+        index += 2;
+
+        s << " " << static_cast<size_t>(jump);
     }
 
-    if (m_lines.count(index) > 0) {
-        line = m_lines.find(index)->second;
+    s << "\n";
+
+    return {s.str(), ++index};
+}
+
+size_t Chunk::getInstructionSize(size_t index) const {
+    switch (static_cast<OpCode>(m_code[index])) {
+        case OpCode::CHECK_CALLABLE:
+        case OpCode::GET_LOCAL:
+        case OpCode::SET_LOCAL:
+        case OpCode::GET_UPVALUE:
+        case OpCode::SET_UPVALUE:
+        case OpCode::CALL:
+        case OpCode::CONSTANT:
+        case OpCode::CHECK_TYPE:
+        case OpCode::INC_LOCAL:
+            return 2;
+
+        case OpCode::ADD_LOCAL_CONSTANT:
+        case OpCode::SUBTRACT_LOCAL_CONSTANT:
+            return 3;
+
+        case OpCode::ARRAY:
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_TRUE:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::LOOP:
+            return 3;
+
+        case OpCode::GET_LOCAL_LONG:
+        case OpCode::SET_LOCAL_LONG:
+        case OpCode::GET_UPVALUE_LONG:
+        case OpCode::SET_UPVALUE_LONG:
+        case OpCode::CONSTANT_LONG:
+        case OpCode::CHECK_TYPE_LONG:
+            return 4;
+
+        case OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE:
+            return 5;
+
+        case OpCode::ARRAY_LONG:
+            return 7;
+
+        case OpCode::CLOSURE:
+        case OpCode::CLOSURE_LONG: {
+            bool isLong = static_cast<OpCode>(m_code[index]) == OpCode::CLOSURE_LONG;
+            size_t constant = isLong ?
+                    m_code[index + 1] | (m_code[index + 2] << 8) | (m_code[index + 3] << 16) :
+                    m_code[index + 1];
+
+            size_t size = isLong ? 4 : 2;
+
+            FunctionObject* function = m_constants[constant].asObject()->as<FunctionObject>();
+            for (uint32_t i = 0; i < function->getUpvalueCount(); ++i) {
+                // An isLocal byte followed by the index.
+                size += i < UINT8_MAX ? 2 : 4;
+            }
+
+            return size;
+        }
+
+        default:
+            return 1;
     }
+}
 
-    return line;
+int Chunk::getStackEffect(size_t index) const {
+    switch (static_cast<OpCode>(m_code[index])) {
+        case OpCode::CONSTANT:
+        case OpCode::CONSTANT_LONG:
+        case OpCode::TRUE:
+        case OpCode::FALSE:
+        case OpCode::NIL:
+        case OpCode::GET_LOCAL:
+        case OpCode::GET_LOCAL_LONG:
+        case OpCode::GET_UPVALUE:
+        case OpCode::GET_UPVALUE_LONG:
+        case OpCode::CLOSURE:
+        case OpCode::CLOSURE_LONG:
+        case OpCode::ADD_LOCAL_CONSTANT:
+        case OpCode::SUBTRACT_LOCAL_CONSTANT:
+            return 1;
+
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::LESS:
+        case OpCode::GREATER:
+        case OpCode::EQUAL:
+        case OpCode::CONCATENATE:
+        case OpCode::ADD_INT:
+        case OpCode::SUBTRACT_INT:
+        case OpCode::MULTIPLY_INT:
+        case OpCode::DIVIDE_INT:
+        case OpCode::LESS_INT:
+        case OpCode::GREATER_INT:
+        case OpCode::LESS_EQUAL_INT:
+        case OpCode::GREATER_EQUAL_INT:
+        case OpCode::ADD_FLOAT:
+        case OpCode::SUBTRACT_FLOAT:
+        case OpCode::MULTIPLY_FLOAT:
+        case OpCode::DIVIDE_FLOAT:
+        case OpCode::LESS_FLOAT:
+        case OpCode::GREATER_FLOAT:
+        case OpCode::ADD_INT_QUICK:
+        case OpCode::SUBTRACT_INT_QUICK:
+        case OpCode::MULTIPLY_INT_QUICK:
+        case OpCode::DIVIDE_INT_QUICK:
+        case OpCode::LESS_INT_QUICK:
+        case OpCode::GREATER_INT_QUICK:
+        case OpCode::ADD_FLOAT_QUICK:
+        case OpCode::SUBTRACT_FLOAT_QUICK:
+        case OpCode::MULTIPLY_FLOAT_QUICK:
+        case OpCode::DIVIDE_FLOAT_QUICK:
+        case OpCode::LESS_FLOAT_QUICK:
+        case OpCode::GREATER_FLOAT_QUICK:
+        case OpCode::GET_ARRAY_INDEX:
+        case OpCode::POP:
+        case OpCode::CLOSE_UPVALUE:
+        case OpCode::RETURN:
+            return -1;
+
+        case OpCode::SET_ARRAY_INDEX:
+            return -2;
+
+        case OpCode::ARRAY:
+            return 1 - static_cast<int>(m_code[index + 1]);
+        case OpCode::ARRAY_LONG:
+            return 1 - static_cast<int>(m_code[index + 1] | (m_code[index + 2] << 8) | (m_code[index + 3] << 16));
+
+        // The callee and its arguments are replaced by the return value.
+        case OpCode::CALL:
+            return -static_cast<int>(m_code[index + 1]);
+
+        default:
+            return 0;
+    }
 }
 
-line_t Chunk::getCurrentLine() const {
-    line_t line = 1;
-    if (m_code.size() > 1) {
-        line = getLine(m_code.size() - 2);
+void Chunk::computeMaxStackDepth() {
+    // Walk every path through the chunk, remembering the depth each instruction was first reached with.
+    std::unordered_map<size_t, int> depths;
+    std::vector<std::pair<size_t, int>> worklist{{0, 0}};
+
+    int maxDepth = 0;
+
+    while (!worklist.empty()) {
+        auto [index, depth] = worklist.back();
+        worklist.pop_back();
+
+        while (index < m_code.size() && depths.count(index) == 0) {
+            depths.insert(std::pair(index, depth));
+
+            depth += getStackEffect(index);
+            maxDepth = std::max(maxDepth, depth);
+
+            auto op = static_cast<OpCode>(m_code[index]);
+            size_t next = index + getInstructionSize(index);
+
+            if (op == OpCode::RETURN) break;
+
+            if (op == OpCode::JUMP || op == OpCode::JUMP_IF_TRUE || op == OpCode::JUMP_IF_FALSE ||
+                    op == OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE) {
+                // The jump distance is always the last operand.
+                size_t target = next + (m_code[next - 2] | (m_code[next - 1] << 8));
+                if (op == OpCode::JUMP) {
+                    next = target;
+                } else {
+                    worklist.emplace_back(target, depth);
+                }
+            } else if (op == OpCode::LOOP) {
+                next -= m_code[index + 1] | (m_code[index + 2] << 8);
+            }
+
+            index = next;
+        }
     }
 
-    return line;
+    m_maxStackDepth = static_cast<size_t>(maxDepth);
+}
+
+size_t Chunk::getMaxStackDepth() const {
+    return m_maxStackDepth;
+}
+
+line_t Chunk::getLine(size_t index) const {
+    // Find the last run that starts at or before index.
+    auto run = std::upper_bound(m_lines.begin(), m_lines.end(), index, [](size_t offset, const LineStart& start) {
+        return offset < start.offset;
+    });
+
+    if (run == m_lines.begin()) return 0;
+    return std::prev(run)->line;
 }
 
 const std::vector<uint8_t>& Chunk::getCode() const {
@@ -363,6 +601,7 @@ std::string opCodeToString(OpCode code) {
         case OpCode::NIL: return "NIL";
         case OpCode::CHECK_INT: return "CHECK_INT";
         case OpCode::CHECK_NUMERIC: return "CHECK_NUMERIC";
+        case OpCode::CHECK_STRING: return "CHECK_STRING";
         case OpCode::CHECK_BOOL: return "CHECK_BOOL";
         case OpCode::CHECK_REFERENCE: return "CHECK_REFERENCE";
         case OpCode::CHECK_CALLABLE: return "CHECK_CALLABLE";
@@ -380,6 +619,37 @@ std::string opCodeToString(OpCode code) {
         case OpCode::LESS: return "LESS";
         case OpCode::GREATER: return "GREATER";
         case OpCode::EQUAL: return "EQUAL";
+        case OpCode::CONCATENATE: return "CONCATENATE";
+        case OpCode::ADD_INT: return "ADD_INT";
+        case OpCode::SUBTRACT_INT: return "SUBTRACT_INT";
+        case OpCode::MULTIPLY_INT: return "MULTIPLY_INT";
+        case OpCode::DIVIDE_INT: return "DIVIDE_INT";
+        case OpCode::LESS_INT: return "LESS_INT";
+        case OpCode::GREATER_INT: return "GREATER_INT";
+        case OpCode::LESS_EQUAL_INT: return "LESS_EQUAL_INT";
+        case OpCode::GREATER_EQUAL_INT: return "GREATER_EQUAL_INT";
+        case OpCode::ADD_FLOAT: return "ADD_FLOAT";
+        case OpCode::SUBTRACT_FLOAT: return "SUBTRACT_FLOAT";
+        case OpCode::MULTIPLY_FLOAT: return "MULTIPLY_FLOAT";
+        case OpCode::DIVIDE_FLOAT: return "DIVIDE_FLOAT";
+        case OpCode::LESS_FLOAT: return "LESS_FLOAT";
+        case OpCode::GREATER_FLOAT: return "GREATER_FLOAT";
+        case OpCode::ADD_INT_QUICK: return "ADD_INT_QUICK";
+        case OpCode::SUBTRACT_INT_QUICK: return "SUBTRACT_INT_QUICK";
+        case OpCode::MULTIPLY_INT_QUICK: return "MULTIPLY_INT_QUICK";
+        case OpCode::DIVIDE_INT_QUICK: return "DIVIDE_INT_QUICK";
+        case OpCode::LESS_INT_QUICK: return "LESS_INT_QUICK";
+        case OpCode::GREATER_INT_QUICK: return "GREATER_INT_QUICK";
+        case OpCode::ADD_FLOAT_QUICK: return "ADD_FLOAT_QUICK";
+        case OpCode::SUBTRACT_FLOAT_QUICK: return "SUBTRACT_FLOAT_QUICK";
+        case OpCode::MULTIPLY_FLOAT_QUICK: return "MULTIPLY_FLOAT_QUICK";
+        case OpCode::DIVIDE_FLOAT_QUICK: return "DIVIDE_FLOAT_QUICK";
+        case OpCode::LESS_FLOAT_QUICK: return "LESS_FLOAT_QUICK";
+        case OpCode::GREATER_FLOAT_QUICK: return "GREATER_FLOAT_QUICK";
+        case OpCode::ADD_LOCAL_CONSTANT: return "ADD_LOCAL_CONSTANT";
+        case OpCode::SUBTRACT_LOCAL_CONSTANT: return "SUBTRACT_LOCAL_CONSTANT";
+        case OpCode::INC_LOCAL: return "INC_LOCAL";
+        case OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE: return "LESS_LOCAL_CONSTANT_JUMP_IF_FALSE";
         case OpCode::ARRAY: return "ARRAY";
         case OpCode::ARRAY_LONG: return "ARRAY_LONG";
         case OpCode::GET_ARRAY_INDEX: return "GET_ARRAY_INDEX";
@@ -405,4 +675,10 @@ std::string opCodeToString(OpCode code) {
         // Unreachable.
         default: return "";
     }
-}
\ No newline at end of file
+}
+
+size_t Chunk::getAllocatedBytes() const {
+    return m_code.capacity() * sizeof(uint8_t) +
+            m_constants.capacity() * sizeof(Value) +
+            m_lines.capacity() * sizeof(LineStart);
+}
@@ -2,16 +2,16 @@
 #include "h/Object.h"
 #include "h/Enact.h"
 #include "h/Natives.h"
-#include "h/GC.h"
+#include "h/Heap.h"
 
-Compiler::Compiler(Compiler* enclosing) : m_enclosing{enclosing} {
-    GC::setCompiler(this);
+Compiler::Compiler(Heap& heap, Compiler* enclosing) : m_heap{heap}, m_enclosing{enclosing} {
+    m_heap.setCompiler(this);
 }
 
 void Compiler::init(FunctionKind functionKind, Type functionType, const std::string& name) {
     m_hadError = false;
 
-    m_currentFunction = GC::allocateObject<FunctionObject>(
+    m_currentFunction = m_heap.allocateOldObject<FunctionObject>(
             functionType,
             Chunk(),
             name
@@ -32,6 +32,26 @@ void Compiler::init(FunctionKind functionKind, Type functionType, const std::str
                      &Natives::put);
         defineNative("dis", std::make_shared<FunctionType>(STRING_TYPE, std::vector<Type>{DYNAMIC_TYPE}),
                      &Natives::dis);
+        defineNative("gcStats", std::make_shared<FunctionType>(STRING_TYPE, std::vector<Type>{}),
+                     &Natives::gcStats);
+        defineNative("sum", std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE}),
+                     &Natives::sum);
+        defineNative("min", std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE}),
+                     &Natives::min);
+        defineNative("max", std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE}),
+                     &Natives::max);
+        defineNative("dot", std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}),
+                     &Natives::dot);
+        defineNative("add", std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}),
+                     &Natives::add);
+        defineNative("mul", std::make_shared<FunctionType>(DYNAMIC_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}),
+                     &Natives::mul);
+        defineNative("fill", std::make_shared<FunctionType>(NOTHING_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}),
+                     &Natives::fill);
+        defineNative("indexOf", std::make_shared<FunctionType>(INT_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}),
+                     &Natives::indexOf);
+        defineNative("count", std::make_shared<FunctionType>(INT_TYPE, std::vector<Type>{DYNAMIC_TYPE, DYNAMIC_TYPE}),
+                     &Natives::count);
     }
 }
 
@@ -40,7 +60,9 @@ FunctionObject* Compiler::end() {
         emitByte(OpCode::NIL);
         emitByte(OpCode::RETURN);
     }
-    GC::setCompiler(nullptr);
+    currentChunk().computeMaxStackDepth();
+    // The enclosing function is still being compiled, so it has to stay a root.
+    m_heap.setCompiler(m_enclosing);
     return m_currentFunction;
 }
 
@@ -89,6 +111,7 @@ void Compiler::visitExpressionStmt(ExpressionStmt &stmt) {
 }
 
 void Compiler::visitForStmt(ForStmt &stmt) {
+    m_currentLine = stmt.keyword.line;
     beginScope();
     compile(*stmt.initializer);
 
@@ -126,11 +149,13 @@ void Compiler::visitForStmt(ForStmt &stmt) {
 }
 
 void Compiler::visitFunctionStmt(FunctionStmt &stmt) {
+    m_currentLine = stmt.name.line;
     addLocal(stmt.name);
     m_locals.back().initialized = true;
 
-    Compiler compiler{this};
+    Compiler compiler{m_heap, this};
     compiler.init(FunctionKind::FUNCTION, stmt.type, stmt.name.lexeme);
+    compiler.m_currentLine = m_currentLine;
 
     for (const Param& param : stmt.params) {
         compiler.addLocal(param.name);
@@ -198,6 +223,7 @@ void Compiler::visitGivenStmt(GivenStmt &stmt) {
 }
 
 void Compiler::visitIfStmt(IfStmt &stmt) {
+    m_currentLine = stmt.keyword.line;
     compile(*stmt.condition);
     if (stmt.condition->getType()->isDynamic()) {
         emitByte(OpCode::CHECK_BOOL);
@@ -235,6 +261,7 @@ void Compiler::visitIfStmt(IfStmt &stmt) {
 }
 
 void Compiler::visitReturnStmt(ReturnStmt &stmt) {
+    m_currentLine = stmt.keyword.line;
     compile(*stmt.value);
     emitByte(OpCode::RETURN);
 }
@@ -248,6 +275,7 @@ void Compiler::visitTraitStmt(TraitStmt &stmt) {
 }
 
 void Compiler::visitWhileStmt(WhileStmt &stmt) {
+    m_currentLine = stmt.keyword.line;
     size_t loopStartIndex = currentChunk().getCount();
 
     compile(*stmt.condition);
@@ -273,18 +301,23 @@ void Compiler::visitWhileStmt(WhileStmt &stmt) {
 }
 
 void Compiler::visitVariableStmt(VariableStmt &stmt) {
+    m_currentLine = stmt.name.line;
     addLocal(stmt.name);
     compile(*stmt.initializer);
     m_locals.back().initialized = true;
 }
 
 void Compiler::visitAllotExpr(AllotExpr& expr) {
+    m_currentLine = expr.oper.line;
     compile(*expr.value);
     compile(*expr.target->object);
 
     if (expr.target->object->getType()->isDynamic()) {
         emitByte(OpCode::CHECK_INDEXABLE);
         emitByte(OpCode::CHECK_ALLOTABLE);
+    } else if (expr.value->getType()->isDynamic() && !expr.target->getType()->isDynamic()) {
+        // The analyser has checked statically typed values, so only dynamic ones are left to check here.
+        emitByte(OpCode::CHECK_ALLOTABLE);
     }
 
     compile(*expr.target->index);
@@ -300,13 +333,14 @@ void Compiler::visitAnyExpr(AnyExpr &expr) {
 }
 
 void Compiler::visitArrayExpr(ArrayExpr &expr) {
+    m_currentLine = expr.square.line;
     for (auto& value : expr.value) {
         compile(*value);
     }
 
     uint32_t length = expr.value.size();
 
-    auto* type = GC::allocateObject<TypeObject>(expr.getType());
+    auto* type = m_heap.allocateOldObject<TypeObject>(expr.getType());
     uint32_t typeConstant = currentChunk().addConstant(Value{type});
 
     if (length <= UINT8_MAX && typeConstant <= UINT8_MAX) {
@@ -321,6 +355,7 @@ void Compiler::visitArrayExpr(ArrayExpr &expr) {
 }
 
 void Compiler::visitAssignExpr(AssignExpr &expr) {
+    m_currentLine = expr.oper.line;
     compile(*expr.value);
 
     uint32_t index;
@@ -347,37 +382,63 @@ void Compiler::visitAssignExpr(AssignExpr &expr) {
 }
 
 void Compiler::visitBinaryExpr(BinaryExpr &expr) {
-    compile(*expr.left);
+    m_currentLine = expr.oper.line;
 
-    if (expr.oper.type != TokenType::EQUAL
+    // The analyser only lets a string be added to another string.
+    bool isConcatenation = expr.oper.type == TokenType::PLUS
+            && (expr.left->getType()->isString() || expr.right->getType()->isString());
+    OpCode checkOp = isConcatenation ? OpCode::CHECK_STRING : OpCode::CHECK_NUMERIC;
+
+    // Two dynamic operands of + may be two numbers or two strings, which ADD checks for itself.
+    bool isChecked = expr.oper.type != TokenType::EQUAL
             && expr.oper.type != TokenType::BANG_EQUAL
-            && expr.left->getType()->isDynamic()) {
-        emitByte(OpCode::CHECK_NUMERIC);
+            && !(expr.oper.type == TokenType::PLUS
+                    && expr.left->getType()->isDynamic() && expr.right->getType()->isDynamic());
+
+    compile(*expr.left);
+
+    if (isChecked && expr.left->getType()->isDynamic()) {
+        emitByte(checkOp);
     }
 
     compile(*expr.right);
 
-    if (expr.oper.type != TokenType::EQUAL
-            && expr.oper.type != TokenType::BANG_EQUAL
-            && expr.right->getType()->isDynamic()) {
-        emitByte(OpCode::CHECK_NUMERIC);
+    if (isChecked && expr.right->getType()->isDynamic()) {
+        emitByte(checkOp);
     }
 
+    Expr& left = *expr.left;
+    Expr& right = *expr.right;
+
     switch (expr.oper.type) {
-        case TokenType::PLUS: emitByte(OpCode::ADD); break;
-        case TokenType::MINUS: emitByte(OpCode::SUBTRACT); break;
-        case TokenType::STAR: emitByte(OpCode::MULTIPLY); break;
-        case TokenType::SLASH: emitByte(OpCode::DIVIDE); break;
+        case TokenType::PLUS:
+            if (isConcatenation) {
+                emitByte(OpCode::CONCATENATE);
+            } else {
+                emitByte(numericOp(left, right, OpCode::ADD, OpCode::ADD_INT, OpCode::ADD_FLOAT));
+            }
+            break;
+        case TokenType::MINUS:
+            emitByte(numericOp(left, right, OpCode::SUBTRACT, OpCode::SUBTRACT_INT, OpCode::SUBTRACT_FLOAT));
+            break;
+        case TokenType::STAR:
+            emitByte(numericOp(left, right, OpCode::MULTIPLY, OpCode::MULTIPLY_INT, OpCode::MULTIPLY_FLOAT));
+            break;
+        case TokenType::SLASH:
+            emitByte(numericOp(left, right, OpCode::DIVIDE, OpCode::DIVIDE_INT, OpCode::DIVIDE_FLOAT));
+            break;
 
-        case TokenType::LESS: emitByte(OpCode::LESS); break;
+        case TokenType::LESS: emitByte(numericOp(left, right, OpCode::LESS, OpCode::LESS_INT, OpCode::LESS_FLOAT)); break;
         case TokenType::LESS_EQUAL:
-            emitByte(OpCode::GREATER);
+            emitByte(numericOp(left, right, OpCode::GREATER, OpCode::GREATER_INT, OpCode::GREATER_FLOAT));
             emitByte(OpCode::NOT);
             break;
 
-        case TokenType::GREATER: emitByte(OpCode::GREATER); break;
+        case TokenType::GREATER:
+            emitByte(numericOp(left, right, OpCode::GREATER, OpCode::GREATER_INT, OpCode::GREATER_FLOAT));
+            break;
         case TokenType::GREATER_EQUAL:
-            emitByte(OpCode::LESS);
+            emitByte(numericOp(left, right, OpCode::LESS, OpCode::LESS_INT, OpCode::LESS_FLOAT));
             emitByte(OpCode::NOT);
             break;
 
@@ -389,11 +450,19 @@ void Compiler::visitBinaryExpr(BinaryExpr &expr) {
     }
 }
 
+OpCode Compiler::numericOp(Expr& left, Expr& right, OpCode generic, OpCode intOp, OpCode floatOp) {
+    // The typed opcodes don't check their operands, so only use them when the analyser has proven both types.
+    if (left.getType()->isInt() && right.getType()->isInt()) return intOp;
+    if (left.getType()->isFloat() && right.getType()->isFloat()) return floatOp;
+    return generic;
+}
+
 void Compiler::visitBooleanExpr(BooleanExpr &expr) {
     emitByte(expr.value ? OpCode::TRUE : OpCode::FALSE);
 }
 
 void Compiler::visitCallExpr(CallExpr &expr) {
+    m_currentLine = expr.paren.line;
     compile(*expr.callee);
 
     bool needRuntimeCheck = expr.callee->getType()->isDynamic();
@@ -427,6 +496,7 @@ void Compiler::visitIntegerExpr(IntegerExpr &expr) {
 }
 
 void Compiler::visitLogicalExpr(LogicalExpr &expr) {
+    m_currentLine = expr.oper.line;
     // Always compile the left operand
     compile(*expr.left);
 
@@ -450,11 +520,12 @@ void Compiler::visitNilExpr(NilExpr &expr) {
 }
 
 void Compiler::visitStringExpr(StringExpr &expr) {
-    Object* string = GC::allocateObject<StringObject>(expr.value);
+    Object* string = m_heap.internString(expr.value);
     emitConstant(Value{string});
 }
 
 void Compiler::visitSubscriptExpr(SubscriptExpr &expr) {
+    m_currentLine = expr.square.line;
     compile(*expr.object);
     if (expr.object->getType()->isDynamic()) {
         emitByte(OpCode::CHECK_INDEXABLE);
@@ -473,6 +544,7 @@ void Compiler::visitTernaryExpr(TernaryExpr &expr) {
 }
 
 void Compiler::visitUnaryExpr(UnaryExpr &expr) {
+    m_currentLine = expr.oper.line;
     compile(*expr.operand);
 
     switch (expr.oper.type) {
@@ -503,6 +575,7 @@ void Compiler::visitUnaryExpr(UnaryExpr &expr) {
 }
 
 void Compiler::visitVariableExpr(VariableExpr &expr) {
+    m_currentLine = expr.name.line;
     uint32_t index;
     OpCode byteOp;
     OpCode longOp;
@@ -610,7 +683,7 @@ uint32_t Compiler::resolveUpvalue(const Token &name) {
 }
 
 void Compiler::defineNative(std::string name, Type functionType, NativeFn function) {
-    Object* native = GC::allocateObject<NativeObject>(functionType, function);
+    Object* native = m_heap.allocateOldObject<NativeObject>(functionType, function);
     emitConstant(Value{native});
 
     addLocal(Token{TokenType::IDENTIFIER, name, 0, 0});
@@ -618,23 +691,23 @@ void Compiler::defineNative(std::string name, Type functionType, NativeFn functi
 }
 
 void Compiler::emitByte(uint8_t byte) {
-    currentChunk().write(byte, currentChunk().getCurrentLine());
+    currentChunk().write(byte, m_currentLine);
 }
 
 void Compiler::emitByte(OpCode byte) {
-    currentChunk().write(byte, currentChunk().getCurrentLine());
+    currentChunk().write(byte, m_currentLine);
 }
 
 void Compiler::emitShort(uint16_t value) {
-    currentChunk().writeShort(value, currentChunk().getCurrentLine());
+    currentChunk().writeShort(value, m_currentLine);
 }
 
 void Compiler::emitLong(uint32_t value) {
-    currentChunk().writeLong(value, currentChunk().getCurrentLine());
+    currentChunk().writeLong(value, m_currentLine);
 }
 
 void Compiler::emitConstant(Value constant) {
-    currentChunk().writeConstant(constant, currentChunk().getCurrentLine());
+    currentChunk().writeConstant(constant, m_currentLine);
 }
 
 size_t Compiler::emitJump(OpCode jump) {
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <sstream>
 
@@ -16,9 +17,13 @@
 #include "h/Value.h"
 #include "h/Object.h"
 #include "h/Compiler.h"
-#include "h/GC.h"
+#include "h/Heap.h"
+#include "h/IsolatePool.h"
+#include "h/Optimizer.h"
+#include "h/Profiler.h"
+#include "h/Sampler.h"
 
-std::string Enact::m_source{};
+thread_local std::string Enact::m_source{};
 
 Flags Enact::m_flags{};
 std::string Enact::m_filename{};
@@ -29,14 +34,17 @@ void Enact::start(int argc, char *argv[]) {
 
     if (m_filename.empty()) {
         runPrompt();
+    } else if (m_flags.flagEnabled(Flag::POOL)) {
+        std::vector<std::string> paths{m_filename};
+        paths.insert(paths.end(), m_programArgs.begin(), m_programArgs.end());
+        runFiles(paths);
     } else {
         runFile(m_filename);
     }
 }
 
-InterpretResult Enact::run(const std::string& source) {
+InterpretResult Enact::compile(const std::string& source, Heap& heap, FunctionObject*& script) {
     m_source = source;
-    FunctionObject* script;
 
     { // Free up memory for the VM
         Parser parser{m_source};
@@ -56,25 +64,123 @@ InterpretResult Enact::run(const std::string& source) {
             }
         }
 
-        Compiler compiler{};
+        Compiler compiler{heap};
         compiler.init(FunctionKind::SCRIPT, std::make_shared<FunctionType>(NOTHING_TYPE, std::vector<Type>{}), "");
         compiler.compile(std::move(statements));
         script = compiler.end();
         if (compiler.hadError()) return InterpretResult::COMPILE_ERROR;
     }
 
+    if (getFlags().flagEnabled(Flag::OPTIMIZE)) {
+        Optimizer optimizer{};
+        optimizer.optimize(script);
+
+        if (getFlags().flagEnabled(Flag::DEBUG_LOG_OPTIMIZER)) {
+            std::cout << "-- OPTIMIZER END: " << optimizer.getInstructionsBefore() << " instructions before, " <<
+                    optimizer.getInstructionsAfter() << " after.\n";
+        }
+    }
+
     if (getFlags().flagEnabled(Flag::DEBUG_DISASSEMBLE_CHUNK)) {
         std::cout << script->getChunk().disassemble();
     }
 
-    VM vm = VM{};
+    return InterpretResult::OK;
+}
+
+InterpretResult Enact::run(const std::string& source) {
+    // Everything this run allocates lives in here, and is freed along with it.
+    Heap heap{};
+    FunctionObject* script;
+
+    InterpretResult compileResult = compile(source, heap, script);
+    if (compileResult != InterpretResult::OK) return compileResult;
+
+    Profiler profiler{};
+    bool isProfiling = getFlags().flagEnabled(Flag::PROFILE);
+
+    Sampler sampler{};
+    bool isSampling = getFlags().flagEnabled(Flag::SAMPLE);
+
+    VM vm{heap};
+    if (isProfiling) {
+        vm.setProfiler(&profiler);
+    }
+
+    if (isSampling && !sampler.start(vm)) {
+        std::cerr << "[enact] Warning: --sample is not supported on this platform.\n";
+        isSampling = false;
+    }
+
     InterpretResult result = vm.run(script);
 
-    GC::freeObjects();
+    if (isProfiling) {
+        profiler.printReport(std::cerr);
+
+        std::ofstream json{PROFILE_PATH};
+        profiler.writeJson(json);
+    }
+
+    if (isSampling) {
+        sampler.stop();
+        std::cerr << "-- SAMPLER: " << sampler.getSampleCount() << " samples, " << sampler.getDroppedCount() <<
+                " dropped, written to " << SAMPLE_PATH << ".\n";
+
+        std::ofstream folded{SAMPLE_PATH};
+        sampler.writeFolded(folded);
+    }
+
+    if (getFlags().flagEnabled(Flag::GC_STATS)) {
+        heap.getStats().print(std::cerr);
+    }
+
     return result;
 }
 
 void Enact::runFile(const std::string &path) {
+    run(readFile(path));
+}
+
+static const char* resultName(InterpretResult result) {
+    switch (result) {
+        case InterpretResult::PARSE_ERROR: return "parse error";
+        case InterpretResult::ANALYSIS_ERROR: return "analysis error";
+        case InterpretResult::COMPILE_ERROR: return "compile error";
+        case InterpretResult::RUNTIME_ERROR: return "runtime error";
+        case InterpretResult::OK: return "ok";
+    }
+
+    return "unknown";
+}
+
+void Enact::runFiles(const std::vector<std::string> &paths) {
+    IsolatePool pool{};
+
+    // A file that is given more than once is compiled once, and its isolates share the bytecode.
+    std::unordered_map<std::string, std::shared_ptr<const Script>> scripts;
+
+    std::vector<std::future<IsolateResult>> results;
+    for (const std::string& path : paths) {
+        std::shared_ptr<const Script>& script = scripts[path];
+        if (!script) script = std::make_shared<const Script>(readFile(path));
+
+        results.push_back(pool.run(script));
+    }
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        IsolateResult result = results[i].get();
+
+        std::cerr << "-- ISOLATE " << paths[i] << ": " << resultName(result.result) << ", compiled in " <<
+                std::chrono::duration_cast<std::chrono::microseconds>(result.compileTime).count() << "us, ran in " <<
+                std::chrono::duration_cast<std::chrono::microseconds>(result.runTime).count() << "us.\n";
+
+        if (getFlags().flagEnabled(Flag::GC_STATS)) {
+            result.gcStats.print(std::cerr);
+        }
+    }
+}
+
+std::string Enact::readFile(const std::string &path) {
     // Get the file contents.
     std::ifstream file{path};
 
@@ -91,7 +197,7 @@ void Enact::runFile(const std::string &path) {
         fileContents << currentLine << "\n";
     }
 
-    run(fileContents.str());
+    return fileContents.str();
 }
 
 void Enact::runPrompt() {
@@ -105,6 +211,10 @@ void Enact::runPrompt() {
     }
 }
 
+void Enact::setSource(const std::string &source) {
+    m_source = source;
+}
+
 std::string Enact::getSourceLine(const line_t line) {
     std::istringstream source{m_source};
     line_t lineNumber{1};
@@ -9,7 +9,15 @@ Flags::Flags(const std::vector<std::string>& strings) : m_flags{} {
 }
 
 void Flags::parseString(const std::string& string) {
-    if (m_parseTable.count(string) > 0) {
+    size_t equals = string.find('=');
+    if (equals != std::string::npos && m_valueParseTable.count(string.substr(0, equals)) > 0) {
+        std::string value = string.substr(equals + 1);
+        if (!m_valueParseTable[string.substr(0, equals)](value)) {
+            std::cerr << "[enact] Error:\n    Invalid value '" << value << "' for interpreter flag '" <<
+                    string.substr(0, equals) << "'.\n\n";
+            m_hadError = true;
+        }
+    } else if (m_parseTable.count(string) > 0) {
         m_parseTable[string]();
     } else {
         std::cerr << "[enact] Error:\n    Unknown interpreter flag '" << string <<
@@ -38,6 +46,30 @@ void Flags::enableFlags(std::vector<Flag> flags) {
     }
 }
 
+const GCOptions& Flags::getGCOptions() const {
+    return m_gcOptions;
+}
+
+bool Flags::parseByteSize(const std::string& string, size_t& size) {
+    // A plain number of bytes, or one followed by K, M or G.
+    char* end;
+    unsigned long long value = std::strtoull(string.c_str(), &end, 10);
+    if (end == string.c_str()) return false;
+
+    switch (*end) {
+        case '\0': break;
+        case 'k': case 'K': value *= 1024; ++end; break;
+        case 'm': case 'M': value *= 1024 * 1024; ++end; break;
+        case 'g': case 'G': value *= 1024 * 1024 * 1024; ++end; break;
+        default: return false;
+    }
+
+    if (*end != '\0') return false;
+
+    size = static_cast<size_t>(value);
+    return true;
+}
+
 bool Flags::hadError() {
     return m_hadError;
 }
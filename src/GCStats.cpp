@@ -0,0 +1,76 @@
+#include "h/GCStats.h"
+
+#include <iomanip>
+
+static const char* objectTypeName(ObjectType type) {
+    switch (type) {
+        case ObjectType::STRING: return "string";
+        case ObjectType::ROPE: return "rope";
+        case ObjectType::ARRAY: return "array";
+        case ObjectType::UPVALUE: return "upvalue";
+        case ObjectType::CLOSURE: return "closure";
+        case ObjectType::FUNCTION: return "function";
+        case ObjectType::NATIVE: return "native";
+        case ObjectType::TYPE: return "type";
+    }
+
+    return "unknown";
+}
+
+static double toMilliseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void GCStats::recordPause(std::chrono::nanoseconds pause) {
+    ++pauseCount;
+    totalPause += pause;
+    if (pause > maxPause) maxPause = pause;
+
+    size_t bucket = 0;
+    for (auto micros = std::chrono::duration_cast<std::chrono::microseconds>(pause).count();
+            micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1) {
+        ++bucket;
+    }
+
+    ++pauseHistogram[bucket];
+}
+
+double GCStats::promotionRate() const {
+    if (youngBytesAllocated == 0) return 0.0;
+    return static_cast<double>(bytesPromoted) / static_cast<double>(youngBytesAllocated);
+}
+
+void GCStats::print(std::ostream& stream) const {
+    std::ios_base::fmtflags flags = stream.flags();
+    stream << std::fixed << std::setprecision(3);
+
+    stream << "-- GC STATS\n";
+    stream << "collections: " << minorCollections << " minor, " << fullCollections << " full, " <<
+            incrementalSlices << " incremental slices\n";
+    stream << "pauses: " << pauseCount << ", " << toMilliseconds(totalPause) << "ms in total, " <<
+            toMilliseconds(maxPause) << "ms at most\n";
+
+    for (size_t i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+        if (pauseHistogram[i] == 0) continue;
+
+        if (i == 0) {
+            stream << "    under 1us: ";
+        } else if (i == GC_PAUSE_BUCKETS - 1) {
+            stream << "    " << (1ull << (i - 1)) << "us or more: ";
+        } else {
+            stream << "    " << (1ull << (i - 1)) << "us to " << (1ull << i) << "us: ";
+        }
+        stream << pauseHistogram[i] << "\n";
+    }
+
+    stream << "allocated: " << youngBytesAllocated << " young bytes, " << oldBytesAllocated << " old bytes\n";
+    stream << "promoted: " << bytesPromoted << " bytes, " << promotionRate() * 100.0 << "% of young bytes\n";
+    stream << "freed: " << bytesFreed << " bytes\n";
+
+    stream << "live after the last full collection:\n";
+    for (size_t i = 0; i < OBJECT_TYPE_COUNT; ++i) {
+        stream << "    " << objectTypeName(static_cast<ObjectType>(i)) << ": " << liveBytes[i] << " bytes\n";
+    }
+
+    stream.flags(flags);
+}
@@ -0,0 +1,910 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include "h/Heap.h"
+#include "h/VM.h"
+#include "h/Compiler.h"
+
+namespace {
+    // Grey objects a marking thread keeps to itself before it lets others steal some.
+    constexpr size_t MARK_SHARE_THRESHOLD = 64;
+
+    // One marking thread's grey stack. The owner works off of its own part without locking, and moves the
+    // older half of it to the stealable part whenever that has run dry.
+    struct MarkWorker {
+        std::vector<Object*> greyStack{};
+
+        std::mutex mutex{};
+        std::vector<Object*> stealable{};
+        std::atomic<size_t> stealableCount{0};
+    };
+
+    // One thread's share of a parallel sweep.
+    struct SweepChunk {
+        size_t begin;
+        size_t end;
+        size_t survivorsEnd;
+        std::array<size_t, OBJECT_TYPE_COUNT> liveBytes;
+        size_t freedBytes;
+
+        // Destroyed objects and their sizes. Their memory is given back to the pool afterwards on one thread.
+        std::vector<std::pair<Object*, size_t>> freed{};
+    };
+}
+
+Heap::Heap() :
+        m_nextRun{Enact::getFlags().getGCOptions().initialThreshold},
+        m_isStressing{Enact::getFlags().flagEnabled(Flag::DEBUG_STRESS_GC)},
+        m_isLogging{Enact::getFlags().flagEnabled(Flag::DEBUG_LOG_GC)},
+        m_nursery{new uint8_t[NURSERY_SIZE]},
+        m_nurseryTop{m_nursery.get()},
+        m_nurseryEnd{m_nursery.get() + NURSERY_SIZE},
+        m_nurseryLimit{m_nurseryEnd} {
+}
+
+Heap::~Heap() {
+    freeObjects();
+}
+
+size_t Heap::objectSize(const Object* object) {
+    switch (object->getObjectType()) {
+        case ObjectType::STRING: return StringObject::allocationSize(object->as<StringObject>()->length());
+        case ObjectType::ROPE: return sizeof(RopeObject);
+        case ObjectType::ARRAY: return sizeof(ArrayObject);
+        case ObjectType::UPVALUE: return sizeof(UpvalueObject);
+        case ObjectType::CLOSURE: return sizeof(ClosureObject);
+        case ObjectType::FUNCTION: return sizeof(FunctionObject);
+        case ObjectType::NATIVE: return sizeof(NativeObject);
+        case ObjectType::TYPE: return sizeof(TypeObject);
+    }
+
+    ENACT_ABORT("Unreachable: unknown object type in Heap::objectSize.");
+}
+
+size_t Heap::ownedBytes(Object* object) {
+    switch (object->getObjectType()) {
+        case ObjectType::ARRAY: return object->as<ArrayObject>()->getAllocatedBytes();
+        case ObjectType::CLOSURE:
+            return object->as<ClosureObject>()->m_upvalues.capacity() * sizeof(UpvalueObject*);
+        case ObjectType::FUNCTION: return object->as<FunctionObject>()->getChunk().getAllocatedBytes();
+        default: return 0;
+    }
+}
+
+void Heap::collectAtLimit(size_t size) {
+    auto start = std::chrono::steady_clock::now();
+
+    if (m_nurseryTop + size > m_nurseryEnd || m_nurseryOwnedBytes + m_largeStringBytes > NURSERY_SIZE) {
+        collectYoung();
+    } else {
+        runSlice();
+    }
+
+    updateNurseryLimit();
+
+    m_stats.recordPause(std::chrono::steady_clock::now() - start);
+}
+
+void Heap::updateNurseryLimit() {
+    // The top never passes the end, so the space left is never negative.
+    if (m_phase != GCPhase::IDLE && static_cast<size_t>(m_nurseryEnd - m_nurseryTop) > GC_SLICE_INTERVAL) {
+        m_nurseryLimit = m_nurseryTop + GC_SLICE_INTERVAL;
+    } else {
+        m_nurseryLimit = m_nurseryEnd;
+    }
+}
+
+void Heap::collectYoung() {
+    if (m_isLogging) {
+        std::cout << "-- MINOR GC BEGIN\n";
+    }
+
+    size_t before = m_bytesAllocated;
+
+    evacuateNursery();
+    ++m_stats.minorCollections;
+
+    if (m_isLogging) {
+        std::cout << "-- MINOR GC END: promoted " << m_bytesAllocated - before << " bytes.\n";
+    }
+
+    const GCOptions& options = Enact::getFlags().getGCOptions();
+
+    if (m_phase != GCPhase::IDLE) {
+        // If the program promotes objects faster than the slices can mark them, the collection would never
+        // finish. Once the old generation has doubled, or reached the heap limit, it is finished in one go.
+        if (m_bytesAllocated > 2 * m_bytesBeforeCollection ||
+                (options.maxHeapSize != 0 && m_bytesAllocated > options.maxHeapSize)) {
+            collectFull();
+        } else {
+            runSlice();
+        }
+    } else if (m_bytesAllocated > m_nextRun) {
+        if (options.sliceBudget == 0) {
+            collectFull();
+        } else {
+            startMarking();
+        }
+    }
+}
+
+void Heap::evacuateNursery() {
+    promoteRoots();
+
+    for (Object* object : m_rememberedSet) {
+        object->setRemembered(false);
+        scanPromoted(object);
+    }
+    m_rememberedSet.clear();
+
+    while (!m_promotedStack.empty()) {
+        Object* object = m_promotedStack.back();
+        m_promotedStack.pop_back();
+        scanPromoted(object);
+    }
+
+    // Everything still in the nursery is either dead or has been moved out, so it can all be destroyed.
+    destroyNursery();
+}
+
+void Heap::destroyNursery() {
+    m_stats.youngBytesAllocated += (m_nurseryTop - m_nursery.get()) + m_nurseryOwnedBytes;
+
+    for (uint8_t* top = m_nursery.get(); top < m_nurseryTop;) {
+        auto* object = reinterpret_cast<Object*>(top);
+        size_t size = alignedSize(objectSize(object));
+        top += size;
+
+        if (object->getForwardingAddress() == nullptr) {
+            m_stats.bytesFreed += size + ownedBytes(object);
+        }
+
+        destroyObject(object);
+    }
+
+    m_nurseryTop = m_nursery.get();
+    m_nurseryOwnedBytes = 0;
+    m_largeStringBytes = 0;
+}
+
+void Heap::promoteRoots() {
+    for (Compiler* compiler = m_currentCompiler; compiler != nullptr; compiler = compiler->m_enclosing) {
+        promoteReference(compiler->m_currentFunction);
+    }
+
+    if (m_currentVM) {
+        for (Value* slot = m_currentVM->m_stack.get(); slot < m_currentVM->m_stackTop; ++slot) {
+            promoteReference(*slot);
+        }
+
+        for (size_t i = 0; i < m_currentVM->m_frameCount; ++i) {
+            promoteReference(m_currentVM->m_frames[i].closure);
+        }
+
+        promoteReference(m_currentVM->m_openUpvalues);
+    }
+}
+
+Object* Heap::promote(Object* object) {
+    if (Object* forwardingAddress = object->getForwardingAddress()) return forwardingAddress;
+
+    Object* promoted = nullptr;
+    switch (object->getObjectType()) {
+        case ObjectType::ROPE: promoted = moveToPool<RopeObject>(object); break;
+        case ObjectType::STRING: {
+            auto* string = object->as<StringObject>();
+            promoted = new (m_pool.allocate(objectSize(string))) StringObject{string->asStringView(), string->getHash()};
+            break;
+        }
+        case ObjectType::ARRAY: promoted = moveToPool<ArrayObject>(object); break;
+        case ObjectType::UPVALUE: promoted = moveToPool<UpvalueObject>(object); break;
+        case ObjectType::CLOSURE: promoted = moveToPool<ClosureObject>(object); break;
+        case ObjectType::FUNCTION: promoted = moveToPool<FunctionObject>(object); break;
+        case ObjectType::NATIVE: promoted = moveToPool<NativeObject>(object); break;
+        case ObjectType::TYPE: promoted = moveToPool<TypeObject>(object); break;
+    }
+
+    object->setForwardingAddress(promoted);
+
+    size_t promotedBytes = objectSize(promoted) + ownedBytes(promoted);
+    m_bytesAllocated += promotedBytes;
+    m_stats.bytesPromoted += promotedBytes;
+    m_objects.push_back(promoted);
+
+    // Its own references have not been looked at yet.
+    m_promotedStack.push_back(promoted);
+
+    // Nothing has looked at it since marking started, so it has to be marked and traced like a root.
+    if (m_phase == GCPhase::MARKING) markObject(promoted);
+
+    if (m_isLogging) {
+        std::cout << static_cast<void *>(object) << ": promoted object to " << static_cast<void *>(promoted) <<
+                  " [ " << *promoted << " ].\n";
+    }
+
+    return promoted;
+}
+
+template <typename T>
+T* Heap::moveToPool(Object* object) {
+    return new (m_pool.allocate(sizeof(T))) T{std::move(*object->as<T>())};
+}
+
+void Heap::promoteReference(Value& value) {
+    if (value.isObject() && isYoung(value.asObject())) {
+        value = Value{promote(value.asObject())};
+    }
+}
+
+template <typename T>
+void Heap::promoteReference(T*& object) {
+    if (object != nullptr && isYoung(object)) {
+        object = static_cast<T*>(promote(object));
+    }
+}
+
+void Heap::scanPromoted(Object* object) {
+    switch (object->getObjectType()) {
+        case ObjectType::ROPE: {
+            auto rope = object->as<RopeObject>();
+            promoteReference(rope->m_left);
+            promoteReference(rope->m_right);
+            break;
+        }
+
+        case ObjectType::ARRAY: {
+            // Unboxed arrays never hold references.
+            auto array = object->as<ArrayObject>();
+            if (array->getStorage() != ArrayStorage::VALUE) break;
+
+            Value* elements = array->getData<Value>();
+            for (size_t i = 0; i < array->length(); ++i) {
+                promoteReference(elements[i]);
+            }
+            break;
+        }
+
+        case ObjectType::UPVALUE: {
+            auto upvalue = object->as<UpvalueObject>();
+            promoteReference(upvalue->m_next);
+            promoteReference(upvalue->m_closed);
+            break;
+        }
+
+        case ObjectType::CLOSURE: {
+            auto closure = object->as<ClosureObject>();
+            promoteReference(closure->m_function);
+            for (UpvalueObject*& upvalue : closure->m_upvalues) {
+                promoteReference(upvalue);
+            }
+            break;
+        }
+
+        default:
+            // Functions are only ever allocated old, and only refer to constants, which are old too.
+            break;
+    }
+}
+
+StringObject* Heap::internString(std::string_view chars) {
+    size_t hash = StringObject::hashString(chars);
+
+    if (StringObject* string = m_strings.find(chars, hash)) {
+        // Nothing may have marked it yet, and it is about to be used again.
+        if (m_phase == GCPhase::MARKING) markObject(string);
+        return string;
+    }
+
+    auto* string = allocateOldString(chars, hash);
+    string->setFlag(Object::INTERNED, true);
+    m_strings.insert(string);
+
+    return string;
+}
+
+StringObject* Heap::allocateOldString(std::string_view chars) {
+    return allocateOldString(chars, StringObject::hashString(chars));
+}
+
+StringObject* Heap::allocateOldString(std::string_view chars, size_t hash) {
+    auto* string = new (m_pool.allocate(StringObject::allocationSize(chars.size()))) StringObject{chars, hash};
+    addOldObject(string);
+    return string;
+}
+
+StringObject* Heap::allocateLargeString(size_t length) {
+    if (m_isStressing) {
+        collectGarbage();
+    } else if (m_nurseryOwnedBytes + m_largeStringBytes > NURSERY_SIZE) {
+        collectAtLimit(0);
+    }
+
+    size_t size = StringObject::allocationSize(length);
+    m_largeStringBytes += size;
+
+    auto* string = new (m_pool.allocate(size)) StringObject{length};
+    addOldObject(string);
+    return string;
+}
+
+Object* Heap::concatenate(const Value& left, const Value& right) {
+    size_t length = left.asObject()->stringLength() + right.asObject()->stringLength();
+
+    // Ropes are never this short, so both halves are plain strings.
+    if (length < MIN_ROPE_LENGTH) {
+        StringObject* string = allocateBlankString(length);
+
+        std::string_view a = left.asObject()->as<StringObject>()->asStringView();
+        std::string_view b = right.asObject()->as<StringObject>()->asStringView();
+        std::memcpy(string->chars(), a.data(), a.size());
+        std::memcpy(string->chars() + a.size(), b.data(), b.size());
+        string->rehash();
+
+        return string;
+    }
+
+    // A flattened rope is the same as the string it was flattened into, and that is cheaper to walk.
+    auto piece = [](Object* half) -> Object* {
+        if (half->is<RopeObject>() && half->as<RopeObject>()->isFlat()) return half->as<RopeObject>()->m_left;
+        return half;
+    };
+
+    // The rope is young, so it needs no write barrier.
+    auto* rope = allocateObject<RopeObject>(length);
+    rope->m_left = piece(left.asObject());
+    rope->m_right = piece(right.asObject());
+    return rope;
+}
+
+StringObject* Heap::flatten(const Value& rope) {
+    auto* flattened = rope.asObject()->as<RopeObject>();
+    if (flattened->isFlat()) return flattened->m_left->as<StringObject>();
+
+    StringObject* flat = allocateBlankString(flattened->length());
+
+    // The rope may have been moved by the allocation.
+    flattened = rope.asObject()->as<RopeObject>();
+    flattened->copyChars(flat->chars());
+    flat->rehash();
+
+    // Dropping the halves lets the pieces be collected.
+    flattened->m_left = flat;
+    flattened->m_right = nullptr;
+    writeBarrier(flattened, flat);
+
+    return flat;
+}
+
+void Heap::addOldObject(Object* object) {
+    m_objects.push_back(object);
+
+    size_t size = objectSize(object) + ownedBytes(object);
+    m_bytesAllocated += size;
+    m_stats.oldBytesAllocated += size;
+
+    // It may be given references to objects that have not been marked yet.
+    if (m_phase == GCPhase::MARKING) markObject(object);
+
+    if (m_isLogging) {
+        std::cout << static_cast<void *>(object) << ": allocated old object of size " << size << " and type " <<
+                  static_cast<int>(object->getObjectType()) << ".\n";
+    }
+}
+
+void Heap::remember(Object* object) {
+    object->setRemembered(true);
+    m_rememberedSet.push_back(object);
+}
+
+void Heap::collectGarbage() {
+    auto start = std::chrono::steady_clock::now();
+
+    collectFull();
+
+    m_stats.recordPause(std::chrono::steady_clock::now() - start);
+}
+
+void Heap::collectFull() {
+    // Marks left behind by an unfinished marking phase are still valid, so marking just carries on from them.
+    // An unfinished sweep has to be completed before anything can be marked again.
+    if (m_phase == GCPhase::SWEEPING) {
+        sweepRemaining();
+        finishSweeping();
+    }
+
+    if (m_phase == GCPhase::IDLE) {
+        startMarking();
+    }
+
+    finishMarking();
+    sweepRemaining();
+    finishSweeping();
+
+    updateNurseryLimit();
+    checkHeapLimit();
+}
+
+void Heap::startMarking() {
+    if (m_isLogging) {
+        std::cout << "-- GC BEGIN\n";
+    }
+
+    m_bytesBeforeCollection = m_bytesAllocated;
+    m_phase = GCPhase::MARKING;
+
+    markRoots();
+}
+
+void Heap::runSlice() {
+    auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::microseconds{Enact::getFlags().getGCOptions().sliceBudget};
+
+    if (m_isLogging) {
+        std::cout << "-- GC SLICE: " << (m_phase == GCPhase::MARKING ? "marking" : "sweeping") << ".\n";
+    }
+
+    ++m_stats.incrementalSlices;
+
+    if (m_phase == GCPhase::MARKING && markSlice(deadline)) {
+        finishMarking();
+    } else if (m_phase == GCPhase::SWEEPING && sweepSlice(deadline)) {
+        finishSweeping();
+        checkHeapLimit();
+    }
+}
+
+bool Heap::markSlice(std::chrono::steady_clock::time_point deadline) {
+    for (size_t work = 1; !m_greyStack.empty(); ++work) {
+        Object* object = m_greyStack.back();
+        m_greyStack.pop_back();
+        blackenObject(object);
+
+        if (work % GC_SLICE_CHECK_INTERVAL == 0 && std::chrono::steady_clock::now() >= deadline) {
+            return m_greyStack.empty();
+        }
+    }
+
+    return true;
+}
+
+void Heap::finishMarking() {
+    // Old objects that are only referred to by young objects have not been marked yet, so the nursery is
+    // emptied, which greys everything it promotes. The roots may have changed since they were first marked too.
+    evacuateNursery();
+    markRoots();
+    traceReferences();
+
+    // The string table's references are weak.
+    m_strings.removeUnmarked();
+
+    m_phase = GCPhase::SWEEPING;
+    m_sweepRead = 0;
+    m_sweepWrite = 0;
+    m_sweepEnd = m_objects.size();
+    m_sweepLiveBytes = {};
+}
+
+bool Heap::sweepSlice(std::chrono::steady_clock::time_point deadline) {
+    // Survivors are compacted towards the front as we go, so every object is only looked at once.
+    // The live size is counted again from scratch, since functions keep growing after they are allocated
+    // while they are being compiled.
+    for (size_t work = 1; m_sweepRead < m_sweepEnd; ++work) {
+        Object* object = m_objects[m_sweepRead++];
+
+        if (object->isShared() || object->isMarked()) {
+            object->unmark();
+            size_t& liveBytes = m_sweepLiveBytes[static_cast<size_t>(object->getObjectType())];
+            liveBytes += objectSize(object) + ownedBytes(object);
+            m_objects[m_sweepWrite++] = object;
+        } else {
+            freeObject(object);
+        }
+
+        if (work % GC_SLICE_CHECK_INTERVAL == 0 && std::chrono::steady_clock::now() >= deadline) {
+            return m_sweepRead == m_sweepEnd;
+        }
+    }
+
+    return true;
+}
+
+void Heap::finishSweeping() {
+    auto survivorsEnd = m_objects.begin() + m_sweepWrite;
+    m_objects.erase(survivorsEnd, m_objects.begin() + m_sweepEnd);
+
+    m_bytesAllocated = 0;
+    for (size_t liveBytes : m_sweepLiveBytes) {
+        m_bytesAllocated += liveBytes;
+    }
+
+    // Objects that became old while sweeping weren't part of this collection.
+    for (auto it = m_objects.begin() + m_sweepWrite; it != m_objects.end(); ++it) {
+        m_bytesAllocated += objectSize(*it) + ownedBytes(*it);
+    }
+
+    m_phase = GCPhase::IDLE;
+
+    ++m_stats.fullCollections;
+    m_stats.liveBytes = m_sweepLiveBytes;
+
+    const GCOptions& options = Enact::getFlags().getGCOptions();
+
+    m_nextRun = static_cast<size_t>(static_cast<double>(m_bytesAllocated) * options.growthFactor);
+    if (options.maxHeapSize != 0 && m_nextRun > options.maxHeapSize) {
+        m_nextRun = options.maxHeapSize;
+    }
+
+    if (m_isLogging) {
+        std::cout << "-- GC END: old generation went from " << m_bytesBeforeCollection << " to " <<
+                  m_bytesAllocated << " bytes, next GC at " << m_nextRun << ".\n";
+
+        for (const ObjectPool::SizeClassStats& stats : m_pool.getStats()) {
+            std::cout << "-- POOL: " << stats.slotSize << " byte slots: " << stats.usedSlots << " of " <<
+                      stats.slotsPerPage * stats.pageOccupancy.size() << " used in " << stats.pageOccupancy.size() <<
+                      " pages.\n";
+        }
+    }
+}
+
+void Heap::checkHeapLimit() {
+    const GCOptions& options = Enact::getFlags().getGCOptions();
+
+    if (options.maxHeapSize != 0 && m_bytesAllocated > options.maxHeapSize) {
+        throw OutOfMemoryError{"Out of memory: " + std::to_string(m_bytesAllocated) + " bytes are still in use "
+                "after collecting garbage, but the heap is limited to " + std::to_string(options.maxHeapSize) + "."};
+    }
+}
+
+std::vector<ObjectPool::SizeClassStats> Heap::getPoolStats() const {
+    return m_pool.getStats();
+}
+
+GCStats Heap::getStats() const {
+    // The nursery's contents are only counted once it is emptied.
+    GCStats stats = m_stats;
+    stats.youngBytesAllocated += (m_nurseryTop - m_nursery.get()) + m_nurseryOwnedBytes;
+    return stats;
+}
+
+size_t Heap::threadCount() const {
+    // Logs written from several threads at once would be unreadable.
+    if (m_objects.size() < PARALLEL_GC_MIN_OBJECTS || m_isLogging) {
+        return 1;
+    }
+
+    size_t threads = Enact::getFlags().getGCOptions().threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+
+    return std::max<size_t>(threads, 1);
+}
+
+void Heap::markRoots() {
+    if (m_currentCompiler) markCompilerRoots();
+    if (m_currentVM) markVMRoots();
+}
+
+void Heap::traceReferences() {
+    size_t threads = threadCount();
+    if (threads > 1) {
+        traceReferencesInParallel(threads);
+        return;
+    }
+
+    while (!m_greyStack.empty()) {
+        Object* object = m_greyStack.back();
+        m_greyStack.pop_back();
+        blackenObject(object);
+    }
+}
+
+void Heap::traceReferencesInParallel(size_t threadCount) {
+    std::vector<MarkWorker> workers(threadCount);
+
+    for (size_t i = 0; i < m_greyStack.size(); ++i) {
+        workers[i % threadCount].greyStack.push_back(m_greyStack[i]);
+    }
+    m_greyStack.clear();
+
+    // Takes half of the first stealable work found, looking at the thread's own first.
+    auto steal = [&workers, threadCount](size_t index) {
+        for (size_t i = 0; i < threadCount; ++i) {
+            MarkWorker& victim = workers[(index + i) % threadCount];
+            if (victim.stealableCount.load() == 0) continue;
+
+            std::lock_guard<std::mutex> lock{victim.mutex};
+
+            auto stolenEnd = victim.stealable.begin() + (victim.stealable.size() + 1) / 2;
+            workers[index].greyStack.insert(workers[index].greyStack.end(), victim.stealable.begin(), stolenEnd);
+            victim.stealable.erase(victim.stealable.begin(), stolenEnd);
+            victim.stealableCount.store(victim.stealable.size());
+
+            if (!workers[index].greyStack.empty()) return true;
+        }
+
+        return false;
+    };
+
+    auto anyStealable = [&workers]() {
+        return std::any_of(workers.begin(), workers.end(), [](const MarkWorker& worker) {
+            return worker.stealableCount.load() > 0;
+        });
+    };
+
+    // Only busy threads make work stealable, so marking is done once every thread is idle at the same time.
+    std::atomic<size_t> idleCount{0};
+
+    auto mark = [&, threadCount](size_t index) {
+        MarkWorker& self = workers[index];
+
+        while (true) {
+            while (!self.greyStack.empty()) {
+                Object* object = self.greyStack.back();
+                self.greyStack.pop_back();
+
+                forEachReference(object, [this, &self](Object* reference) {
+                    if (reference != nullptr && !isYoung(reference) && !reference->isShared() && reference->mark()) {
+                        self.greyStack.push_back(reference);
+                    }
+                });
+
+                if (self.greyStack.size() > MARK_SHARE_THRESHOLD && self.stealableCount.load() == 0) {
+                    std::lock_guard<std::mutex> lock{self.mutex};
+
+                    auto sharedEnd = self.greyStack.begin() + self.greyStack.size() / 2;
+                    self.stealable.assign(self.greyStack.begin(), sharedEnd);
+                    self.greyStack.erase(self.greyStack.begin(), sharedEnd);
+                    self.stealableCount.store(self.stealable.size());
+                }
+            }
+
+            if (steal(index)) continue;
+
+            ++idleCount;
+            while (true) {
+                if (idleCount.load() == threadCount) return;
+
+                if (anyStealable()) {
+                    --idleCount;
+                    if (steal(index)) break;
+                    ++idleCount;
+                }
+
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(mark, i);
+    }
+
+    mark(0);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void Heap::sweepRemaining() {
+    size_t threads = threadCount();
+    if (threads > 1) {
+        sweepInParallel(threads);
+    } else {
+        sweepSlice(std::chrono::steady_clock::time_point::max());
+    }
+}
+
+void Heap::sweepInParallel(size_t threadCount) {
+    // Every thread compacts and destroys its own contiguous chunk of the old generation.
+    size_t chunkSize = (m_sweepEnd - m_sweepRead + threadCount - 1) / threadCount;
+
+    std::vector<SweepChunk> chunks{};
+    for (size_t begin = m_sweepRead; begin < m_sweepEnd; begin += chunkSize) {
+        chunks.push_back(SweepChunk{begin, std::min(begin + chunkSize, m_sweepEnd), begin, {}, 0});
+    }
+
+    auto sweepChunk = [this](SweepChunk& chunk) {
+        for (size_t i = chunk.begin; i < chunk.end; ++i) {
+            Object* object = m_objects[i];
+
+            if (object->isShared() || object->isMarked()) {
+                object->unmark();
+                size_t& liveBytes = chunk.liveBytes[static_cast<size_t>(object->getObjectType())];
+                liveBytes += objectSize(object) + ownedBytes(object);
+                m_objects[chunk.survivorsEnd++] = object;
+            } else {
+                size_t size = objectSize(object);
+                chunk.freedBytes += size + ownedBytes(object);
+                destroyObject(object);
+                chunk.freed.emplace_back(object, size);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        threads.emplace_back(sweepChunk, std::ref(chunks[i]));
+    }
+
+    if (!chunks.empty()) sweepChunk(chunks[0]);
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // The pool isn't thread safe, so the chunks are stitched back together on this thread.
+    for (SweepChunk& chunk : chunks) {
+        for (auto [object, size] : chunk.freed) {
+            m_pool.free(object, size);
+        }
+
+        for (size_t i = chunk.begin; i < chunk.survivorsEnd; ++i) {
+            m_objects[m_sweepWrite++] = m_objects[i];
+        }
+
+        for (size_t i = 0; i < OBJECT_TYPE_COUNT; ++i) {
+            m_sweepLiveBytes[i] += chunk.liveBytes[i];
+        }
+        m_stats.bytesFreed += chunk.freedBytes;
+    }
+
+    m_sweepRead = m_sweepEnd;
+}
+
+void Heap::markCompilerRoots() {
+    Compiler* compiler = m_currentCompiler;
+    while (compiler != nullptr) {
+        markObject(compiler->m_currentFunction);
+        compiler = compiler->m_enclosing;
+    }
+}
+
+void Heap::markVMRoots() {
+    for (Value* slot = m_currentVM->m_stack.get(); slot < m_currentVM->m_stackTop; ++slot) {
+        markValue(*slot);
+    }
+
+    for (size_t i = 0; i < m_currentVM->m_frameCount; ++i) {
+        markObject(m_currentVM->m_frames[i].closure);
+    }
+
+    for (UpvalueObject* upvalue = m_currentVM->m_openUpvalues; upvalue != nullptr; upvalue = upvalue->getNext()) {
+        markObject(upvalue);
+    }
+}
+
+void Heap::markObject(Object *object) {
+    // Young objects may still move. They are marked once they have been promoted instead.
+    if (!object || isYoung(object) || object->isShared() || !object->mark()) return;
+
+    m_greyStack.push_back(object);
+
+    if (m_isLogging) {
+        std::cout << static_cast<void *>(object) << ": marked object [ " << *object << " ].\n";
+    }
+}
+
+void Heap::markValue(Value value) {
+    if (value.isObject()) {
+        markObject(value.asObject());
+    }
+}
+
+void Heap::blackenObject(Object *object) {
+    if (m_isLogging) {
+        std::cout << static_cast<void *>(object) << ": blackened object [ " << *object << " ].\n";
+    }
+
+    forEachReference(object, [this](Object* reference) {
+        markObject(reference);
+    });
+}
+
+template <typename F>
+void Heap::forEachReference(Object* object, F&& visit) {
+    auto visitValue = [&visit](const Value& value) {
+        if (value.isObject()) visit(value.asObject());
+    };
+
+    switch (object->getObjectType()) {
+        case ObjectType::ROPE: {
+            auto rope = object->as<RopeObject>();
+            visit(rope->m_left);
+            if (rope->m_right != nullptr) visit(rope->m_right);
+            break;
+        }
+
+        case ObjectType::CLOSURE: {
+            auto closure = object->as<ClosureObject>();
+            visit(closure->getFunction());
+            for (UpvalueObject* upvalue : closure->getUpvalues()) {
+                visit(upvalue);
+            }
+            break;
+        }
+
+        case ObjectType::FUNCTION:
+            for (const Value& constant : object->as<FunctionObject>()->getChunk().getConstants()) {
+                visitValue(constant);
+            }
+            break;
+
+        case ObjectType::UPVALUE:
+            visitValue(object->as<UpvalueObject>()->getClosed());
+            break;
+
+        case ObjectType::ARRAY: {
+            auto array = object->as<ArrayObject>();
+            if (array->getStorage() != ArrayStorage::VALUE) break;
+
+            const Value* elements = array->getData<Value>();
+            for (size_t i = 0; i < array->length(); ++i) {
+                visitValue(elements[i]);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void Heap::destroyObject(Object* object) {
+    object->visit([](auto* derived) {
+        using T = std::remove_pointer_t<decltype(derived)>;
+        derived->~T();
+    });
+}
+
+void Heap::freeObject(Object* object) {
+    if (m_isLogging) {
+        std::cout << static_cast<void *>(object) << ": freed object of type " <<
+                  static_cast<int>(object->getObjectType()) << ".\n";
+    }
+
+    size_t size = objectSize(object);
+    size_t bytes = size + ownedBytes(object);
+    m_bytesAllocated -= bytes;
+    m_stats.bytesFreed += bytes;
+
+    destroyObject(object);
+    m_pool.free(object, size);
+}
+
+void Heap::freeObjects() {
+    destroyNursery();
+
+    // Drop the objects that an unfinished sweep has already freed or moved.
+    if (m_phase == GCPhase::SWEEPING) {
+        m_objects.erase(m_objects.begin() + m_sweepWrite, m_objects.begin() + m_sweepRead);
+    }
+    m_phase = GCPhase::IDLE;
+    m_greyStack.clear();
+    updateNurseryLimit();
+
+    // The pool hands back all of its pages at once, so the objects only need to be destroyed.
+    for (Object* object : m_objects) {
+        destroyObject(object);
+    }
+    m_objects.clear();
+    m_strings.clear();
+    m_pool.releaseAll();
+    m_rememberedSet.clear();
+}
+
+void Heap::share() {
+    ENACT_ASSERT(m_nurseryTop == m_nursery.get(), "Heap::share: only old objects can be shared.");
+
+    for (Object* object : m_objects) {
+        object->share();
+    }
+}
+
+void Heap::setCompiler(Compiler *compiler) {
+    m_currentCompiler = compiler;
+}
+
+void Heap::setVM(VM *vm) {
+    m_currentVM = vm;
+}
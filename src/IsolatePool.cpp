@@ -0,0 +1,120 @@
+#include "h/IsolatePool.h"
+#include "h/VM.h"
+
+using Clock = std::chrono::steady_clock;
+
+Script::Script(std::string source) : m_source{std::move(source)} {
+    Clock::time_point start = Clock::now();
+    m_compileResult = Enact::compile(m_source, m_heap, m_function);
+    m_compileTime = Clock::now() - start;
+
+    m_heap.share();
+}
+
+const std::string& Script::getSource() const {
+    return m_source;
+}
+
+FunctionObject* Script::getFunction() const {
+    return m_function;
+}
+
+InterpretResult Script::getCompileResult() const {
+    return m_compileResult;
+}
+
+std::chrono::nanoseconds Script::getCompileTime() const {
+    return m_compileTime;
+}
+
+static IsolateResult runIsolate(const Script& script) {
+    IsolateResult result{script.getCompileResult(), script.getCompileTime(), std::chrono::nanoseconds{0}, {}};
+    if (result.result != InterpretResult::OK) return result;
+
+    // Runtime errors print lines from this thread's source.
+    Enact::setSource(script.getSource());
+
+    Clock::time_point start = Clock::now();
+    {
+        Heap heap{};
+        VM vm{heap};
+        result.result = vm.run(script.getFunction());
+        result.gcStats = heap.getStats();
+    }
+    result.runTime = Clock::now() - start;
+
+    return result;
+}
+
+IsolatePool::IsolatePool(size_t threadCount) {
+    if (threadCount == 0) threadCount = 1;
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        m_workers.emplace_back(&IsolatePool::workerLoop, this);
+    }
+}
+
+IsolatePool::~IsolatePool() {
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void IsolatePool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_wakeUp.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+
+            // Whatever was queued before the pool was destroyed still runs.
+            if (m_tasks.empty()) return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+void IsolatePool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_tasks.push_back(std::move(task));
+    }
+    m_wakeUp.notify_one();
+}
+
+std::future<IsolateResult> IsolatePool::run(std::shared_ptr<const Script> script) {
+    // std::function has to be copyable, which packaged_task isn't.
+    auto task = std::make_shared<std::packaged_task<IsolateResult()>>([script] {
+        return runIsolate(*script);
+    });
+
+    std::future<IsolateResult> result = task->get_future();
+    enqueue([task] { (*task)(); });
+    return result;
+}
+
+std::future<IsolateResult> IsolatePool::run(std::string source) {
+    auto task = std::make_shared<std::packaged_task<IsolateResult()>>([source = std::move(source)] {
+        Script script{source};
+        return runIsolate(script);
+    });
+
+    std::future<IsolateResult> result = task->get_future();
+    enqueue([task] { (*task)(); });
+    return result;
+}
+
+size_t IsolatePool::getThreadCount() const {
+    return m_workers.size();
+}
@@ -1,18 +1,219 @@
+#include <algorithm>
+#include <sstream>
 #include "h/Natives.h"
+#include "h/ArrayKernels.h"
 #include "h/Chunk.h"
 #include "h/Object.h"
+#include "h/Heap.h"
+#include "h/VM.h"
 
-Value Natives::print(uint8_t argCount, Value* args) {
-    std::cout << args[0] << "\n";
+// Strings are written out directly, without copying them into a std::string first.
+static void write(VM& vm, const Value& value) {
+    if (value.isObject() && value.asObject()->is<RopeObject>()) {
+        std::cout << vm.getHeap().flatten(value)->asStringView();
+    } else if (value.isObject() && value.asObject()->is<StringObject>()) {
+        std::cout << value.asObject()->as<StringObject>()->asStringView();
+    } else {
+        std::cout << value;
+    }
+}
+
+Value Natives::print(VM& vm, uint8_t, Value* args) {
+    write(vm, args[0]);
+    std::cout << "\n";
     return Value{};
 }
 
-Value Natives::put(uint8_t argCount, Value* args) {
-    std::cout << args[0];
+Value Natives::put(VM& vm, uint8_t, Value* args) {
+    write(vm, args[0]);
     return Value{};
 }
 
-Value Natives::dis(uint8_t count, Value* args) {
+Value Natives::dis(VM& vm, uint8_t, Value* args) {
     Chunk& chunk = args[0].asObject()->as<ClosureObject>()->getFunction()->getChunk();
-    return Value{new StringObject{chunk.disassemble()}};
-}
\ No newline at end of file
+    return Value{vm.getHeap().allocateString(chunk.disassemble())};
+}
+
+Value Natives::gcStats(VM& vm, uint8_t, Value*) {
+    std::stringstream stats;
+    vm.getHeap().getStats().print(stats);
+    return Value{vm.getHeap().allocateString(stats.str())};
+}
+
+static ArrayObject* asArray(const std::string& native, const Value& value) {
+    if (!value.isObject() || !value.asObject()->is<ArrayObject>()) {
+        throw Natives::Error{"Expected an array in " + native + "(), but got a value of type '" +
+                value.getType()->toString() + "' instead."};
+    }
+    return value.asObject()->as<ArrayObject>();
+}
+
+// The kernels only work on arrays of ints and floats.
+static ArrayObject* asNumericArray(const std::string& native, const Value& value) {
+    if (value.isObject() && value.asObject()->is<ArrayObject>()) {
+        auto* array = value.asObject()->as<ArrayObject>();
+        if (array->getStorage() == ArrayStorage::INT || array->getStorage() == ArrayStorage::FLOAT) return array;
+    }
+
+    throw Natives::Error{"Expected an array of type 'int[]' or 'float[]' in " + native +
+            "(), but got a value of type '" + value.getType()->toString() + "' instead."};
+}
+
+static void checkSameShape(const std::string& native, const ArrayObject* left, const ArrayObject* right) {
+    if (left->getStorage() != right->getStorage()) {
+        throw Natives::Error{"Expected arrays of the same type in " + native + "(), but got arrays of type '" +
+                left->getType()->toString() + "' and '" + right->getType()->toString() + "' instead."};
+    }
+
+    if (left->length() != right->length()) {
+        throw Natives::Error{"Expected arrays of the same length in " + native + "(), but got arrays of length " +
+                std::to_string(left->length()) + " and " + std::to_string(right->length()) + " instead."};
+    }
+}
+
+// Allocates the array that an elementwise operation on args[0] and args[1] puts its results in. This may collect
+// garbage, so the operands have to be looked up in args again afterwards.
+static ArrayObject* elementwiseResult(VM& vm, const std::string& native, Value* args) {
+    ArrayObject* left = asNumericArray(native, args[0]);
+    ArrayObject* right = asNumericArray(native, args[1]);
+    checkSameShape(native, left, right);
+
+    return vm.getHeap().allocateObject<ArrayObject>(left->length(), left->getType());
+}
+
+Value Natives::sum(VM&, uint8_t, Value* args) {
+    ArrayObject* array = asNumericArray("sum", args[0]);
+    if (array->getStorage() == ArrayStorage::INT) {
+        return Value{ArrayKernels::sum(array->getData<int32_t>(), array->length())};
+    }
+    return Value{ArrayKernels::sum(array->getData<double>(), array->length())};
+}
+
+Value Natives::min(VM&, uint8_t, Value* args) {
+    ArrayObject* array = asNumericArray("min", args[0]);
+    if (array->length() == 0) throw Error{"Cannot take the minimum of an empty array."};
+
+    if (array->getStorage() == ArrayStorage::INT) {
+        return Value{ArrayKernels::min(array->getData<int32_t>(), array->length())};
+    }
+    return Value{ArrayKernels::min(array->getData<double>(), array->length())};
+}
+
+Value Natives::max(VM&, uint8_t, Value* args) {
+    ArrayObject* array = asNumericArray("max", args[0]);
+    if (array->length() == 0) throw Error{"Cannot take the maximum of an empty array."};
+
+    if (array->getStorage() == ArrayStorage::INT) {
+        return Value{ArrayKernels::max(array->getData<int32_t>(), array->length())};
+    }
+    return Value{ArrayKernels::max(array->getData<double>(), array->length())};
+}
+
+Value Natives::dot(VM&, uint8_t, Value* args) {
+    ArrayObject* left = asNumericArray("dot", args[0]);
+    ArrayObject* right = asNumericArray("dot", args[1]);
+    checkSameShape("dot", left, right);
+
+    if (left->getStorage() == ArrayStorage::INT) {
+        return Value{ArrayKernels::dot(left->getData<int32_t>(), right->getData<int32_t>(), left->length())};
+    }
+    return Value{ArrayKernels::dot(left->getData<double>(), right->getData<double>(), left->length())};
+}
+
+Value Natives::add(VM& vm, uint8_t, Value* args) {
+    ArrayObject* result = elementwiseResult(vm, "add", args);
+    ArrayObject* left = args[0].asObject()->as<ArrayObject>();
+    ArrayObject* right = args[1].asObject()->as<ArrayObject>();
+
+    if (result->getStorage() == ArrayStorage::INT) {
+        ArrayKernels::add(left->getData<int32_t>(), right->getData<int32_t>(), result->getData<int32_t>(),
+                          result->length());
+    } else {
+        ArrayKernels::add(left->getData<double>(), right->getData<double>(), result->getData<double>(),
+                          result->length());
+    }
+    return Value{result};
+}
+
+Value Natives::mul(VM& vm, uint8_t, Value* args) {
+    ArrayObject* result = elementwiseResult(vm, "mul", args);
+    ArrayObject* left = args[0].asObject()->as<ArrayObject>();
+    ArrayObject* right = args[1].asObject()->as<ArrayObject>();
+
+    if (result->getStorage() == ArrayStorage::INT) {
+        ArrayKernels::multiply(left->getData<int32_t>(), right->getData<int32_t>(), result->getData<int32_t>(),
+                               result->length());
+    } else {
+        ArrayKernels::multiply(left->getData<double>(), right->getData<double>(), result->getData<double>(),
+                               result->length());
+    }
+    return Value{result};
+}
+
+Value Natives::fill(VM& vm, uint8_t, Value* args) {
+    ArrayObject* array = asArray("fill", args[0]);
+
+    Type shouldBe = array->getType()->as<ArrayType>()->getElementType();
+    Type valueType = args[1].getType();
+    if (!valueType->looselyEquals(*shouldBe)) {
+        throw Error{"Expected a value of type '" + shouldBe->toString() +
+                "' to fill the array with, but got a value of type '" + valueType->toString() + "' instead."};
+    }
+
+    array->fill(args[1]);
+    vm.getHeap().writeBarrier(array, args[1]);
+    return Value{};
+}
+
+// Unboxed arrays only hold values of their own type, so nothing else is ever found in them.
+Value Natives::indexOf(VM&, uint8_t, Value* args) {
+    ArrayObject* array = asArray("indexOf", args[0]);
+    const Value& value = args[1];
+
+    size_t length = array->length();
+    size_t index = length;
+    switch (array->getStorage()) {
+        case ArrayStorage::INT:
+            if (value.isInt()) index = ArrayKernels::indexOf(array->getData<int32_t>(), length, value.asInt());
+            break;
+        case ArrayStorage::FLOAT:
+            if (value.isDouble()) index = ArrayKernels::indexOf(array->getData<double>(), length, value.asDouble());
+            break;
+        case ArrayStorage::BOOL:
+            if (value.isBool()) index = ArrayKernels::indexOf(array->getData<uint64_t>(), length, value.asBool());
+            break;
+        case ArrayStorage::VALUE: {
+            const Value* values = array->getData<Value>();
+            index = std::find(values, values + length, value) - values;
+            break;
+        }
+    }
+
+    return Value{index == length ? -1 : static_cast<int>(index)};
+}
+
+Value Natives::count(VM&, uint8_t, Value* args) {
+    ArrayObject* array = asArray("count", args[0]);
+    const Value& value = args[1];
+
+    size_t length = array->length();
+    size_t count = 0;
+    switch (array->getStorage()) {
+        case ArrayStorage::INT:
+            if (value.isInt()) count = ArrayKernels::count(array->getData<int32_t>(), length, value.asInt());
+            break;
+        case ArrayStorage::FLOAT:
+            if (value.isDouble()) count = ArrayKernels::count(array->getData<double>(), length, value.asDouble());
+            break;
+        case ArrayStorage::BOOL:
+            if (value.isBool()) count = ArrayKernels::count(array->getData<uint64_t>(), length, value.asBool());
+            break;
+        case ArrayStorage::VALUE: {
+            const Value* values = array->getData<Value>();
+            count = std::count(values, values + length, value);
+            break;
+        }
+    }
+
+    return Value{static_cast<int>(count)};
+}
@@ -1,44 +1,94 @@
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include "h/Object.h"
 #include "h/Value.h"
 #include "h/Chunk.h"
 #include "h/VM.h"
-#include "h/GC.h"
+#include "h/Heap.h"
 
 #ifdef DEBUG_LOG_GC
 #include <iostream>
 #include "h/Chunk.h"
 #endif
 
-Object::Object(ObjectType type) : m_type{type} {
+Object::Object(ObjectType type) : m_header{static_cast<uint64_t>(type)} {
 }
 
-Object::~Object() {
+Object::Object(const Object& object) : m_header{static_cast<uint64_t>(object.getObjectType())} {
+}
+
+// Ropes that have not been flattened yet are spelled out into scratch.
+static std::string_view stringContents(const Object& object, std::string& scratch) {
+    if (object.is<StringObject>()) return object.as<StringObject>()->asStringView();
+    if (auto flat = object.as<RopeObject>()->getFlat()) return flat->asStringView();
+
+    scratch.resize(object.stringLength());
+    object.as<RopeObject>()->copyChars(scratch.data());
+    return scratch;
 }
 
 bool Object::operator==(const Object &object) const {
-    if (m_type != object.m_type) {
+    if (isString() && object.isString() && (is<RopeObject>() || object.is<RopeObject>())) {
+        if (stringLength() != object.stringLength()) return false;
+
+        std::string a, b;
+        return stringContents(*this, a) == stringContents(object, b);
+    }
+
+    if (getObjectType() != object.getObjectType()) {
         return false;
     }
 
-    switch (m_type) {
-        case ObjectType::STRING:
-            return this->as<StringObject>()->asStdString() == object.as<StringObject>()->asStdString();
+    switch (getObjectType()) {
+        case ObjectType::STRING: {
+            auto a = this->as<StringObject>();
+            auto b = object.as<StringObject>();
+
+            // There is only ever one interned string with the same contents.
+            if (a == b) return true;
+            if (a->isInterned() && b->isInterned()) return false;
+
+            return a->getHash() == b->getHash() && a->asStringView() == b->asStringView();
+        }
         case ObjectType::ARRAY:
-            return this->as<ArrayObject>()->asVector() == object.as<ArrayObject>()->asVector();
+            return *this->as<ArrayObject>() == *object.as<ArrayObject>();
+        case ObjectType::ROPE:
+            ENACT_ABORT("Unreachable: ropes are compared by their contents before the switch.");
+        case ObjectType::UPVALUE:
+        case ObjectType::CLOSURE:
+        case ObjectType::FUNCTION:
+        case ObjectType::NATIVE:
+        case ObjectType::TYPE:
+            // Everything else is only equal to itself.
+            return this == &object;
     }
+
+    ENACT_ABORT("Unreachable: unknown object type in Object::operator==.");
+}
+
+void Object::share() {
+    setFlag(SHARED, true);
+}
+
+bool Object::isShared() const {
+    return (header() & SHARED) != 0;
+}
+
+size_t Object::stringLength() const {
+    return is<StringObject>() ? as<StringObject>()->length() : as<RopeObject>()->length();
 }
 
-void Object::mark() {
-    m_isMarked = true;
+std::string Object::toString() const {
+    return visit([](const auto* object) { return object->toString(); });
 }
 
-void Object::unmark() {
-    m_isMarked = false;
+Type Object::getType() const {
+    return visit([](const auto* object) { return object->getType(); });
 }
 
-bool Object::isMarked() {
-    return m_isMarked;
+Object* Object::clone(Heap& heap) const {
+    return visit([&heap](const auto* object) -> Object* { return object->clone(heap); });
 }
 
 std::ostream& operator<<(std::ostream& stream, const Object& object) {
@@ -46,53 +96,213 @@ std::ostream& operator<<(std::ostream& stream, const Object& object) {
     return stream;
 }
 
-StringObject::StringObject(std::string data) : Object{ObjectType::STRING}, m_data{std::move(data)} {
+StringObject::StringObject(std::string_view chars, size_t hash) :
+        Object{ObjectType::STRING}, m_hash{hash}, m_length{chars.size()} {
+    std::memcpy(this->chars(), chars.data(), m_length);
+    this->chars()[m_length] = '\0';
+}
 
+StringObject::StringObject(size_t length) : Object{ObjectType::STRING}, m_hash{0}, m_length{length} {
+    chars()[m_length] = '\0';
 }
 
-const std::string& StringObject::asStdString() const {
-    return m_data;
+char* StringObject::chars() {
+    return reinterpret_cast<char*>(this + 1);
+}
+
+void StringObject::rehash() {
+    m_hash = hashString(asStringView());
+}
+
+size_t StringObject::length() const {
+    return m_length;
+}
+
+const char* StringObject::getChars() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+
+std::string_view StringObject::asStringView() const {
+    return std::string_view{getChars(), m_length};
+}
+
+size_t StringObject::getHash() const {
+    return m_hash;
+}
+
+size_t StringObject::hashString(std::string_view chars) {
+    // FNV-1a.
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : chars) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+
+    return static_cast<size_t>(hash);
 }
 
 std::string StringObject::toString() const {
-    return asStdString();
+    return std::string{asStringView()};
 }
 
 Type StringObject::getType() const {
     return STRING_TYPE;
 }
 
-StringObject* StringObject::clone() const {
-    return GC::allocateObject<StringObject>(*this);
+StringObject* StringObject::clone(Heap& heap) const {
+    return heap.allocateOldString(asStringView());
 }
 
-ArrayObject::ArrayObject(Type type) : Object{ObjectType::ARRAY}, m_type{type}, m_vector{} {
+RopeObject::RopeObject(size_t length) : Object{ObjectType::ROPE}, m_length{length} {
 }
 
-ArrayObject::ArrayObject(size_t length, Type type) : Object{ObjectType::ARRAY}, m_vector{length}, m_type{type} {
+size_t RopeObject::length() const {
+    return m_length;
 }
 
-ArrayObject::ArrayObject(std::vector<Value> vector, Type type) : Object{ObjectType::ARRAY}, m_vector{std::move(vector)}, m_type{type} {
+bool RopeObject::isFlat() const {
+    return m_right == nullptr;
 }
 
-size_t ArrayObject::length() const {
-    return m_vector.size();
+const StringObject* RopeObject::getFlat() const {
+    return isFlat() ? m_left->as<StringObject>() : nullptr;
 }
 
-Value& ArrayObject::at(size_t index) {
-    return m_vector[index];
+void RopeObject::copyChars(char* out) const {
+    // Ropes built in a loop lean heavily to one side, so they are walked without recursing.
+    std::vector<const Object*> pieces{this};
+    while (!pieces.empty()) {
+        const Object* piece = pieces.back();
+        pieces.pop_back();
+
+        if (piece->is<StringObject>()) {
+            std::string_view chars = piece->as<StringObject>()->asStringView();
+            std::memcpy(out, chars.data(), chars.size());
+            out += chars.size();
+        } else {
+            auto rope = piece->as<RopeObject>();
+            if (rope->m_right != nullptr) pieces.push_back(rope->m_right);
+            pieces.push_back(rope->m_left);
+        }
+    }
+}
+
+std::string RopeObject::toString() const {
+    std::string string(m_length, '\0');
+    copyChars(string.data());
+    return string;
+}
+
+Type RopeObject::getType() const {
+    return STRING_TYPE;
+}
+
+StringObject* RopeObject::clone(Heap& heap) const {
+    return heap.allocateOldString(toString());
+}
+
+ArrayObject::ArrayObject(Type type) : ArrayObject{size_t{0}, std::move(type)} {
+}
+
+ArrayObject::ArrayObject(size_t length, Type type) :
+        Object{ObjectType::ARRAY},
+        m_type{std::move(type)},
+        m_storage{storageFor(m_type)},
+        m_length{length},
+        m_data{new uint64_t[wordCount(m_storage, length)]()} {
+    if (m_storage == ArrayStorage::VALUE) {
+        std::uninitialized_fill_n(getData<Value>(), m_length, Value{});
+    }
 }
 
-const Value& ArrayObject::at(size_t index) const {
-    return m_vector[index];
+ArrayObject::ArrayObject(const std::vector<Value>& values, Type type) : ArrayObject{values.size(), std::move(type)} {
+    for (size_t i = 0; i < values.size(); ++i) {
+        set(i, values[i]);
+    }
 }
 
-void ArrayObject::append(Value value) {
-    m_vector.push_back(value);
+ArrayObject::ArrayObject(const ArrayObject& array) :
+        Object{array},
+        m_type{array.m_type},
+        m_storage{array.m_storage},
+        m_length{array.m_length},
+        m_data{new uint64_t[wordCount(m_storage, m_length)]} {
+    std::memcpy(m_data.get(), array.m_data.get(), wordCount(m_storage, m_length) * sizeof(uint64_t));
 }
 
-const std::vector<Value>& ArrayObject::asVector() const {
-    return m_vector;
+size_t ArrayObject::wordCount(ArrayStorage storage, size_t length) {
+    switch (storage) {
+        case ArrayStorage::INT: return (length * sizeof(int32_t) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        case ArrayStorage::FLOAT: return length;
+        case ArrayStorage::BOOL: return (length + 63) / 64;
+        case ArrayStorage::VALUE: break;
+    }
+
+    static_assert(sizeof(Value) % sizeof(uint64_t) == 0, "ArrayObject: values have to fill whole words.");
+    return length * (sizeof(Value) / sizeof(uint64_t));
+}
+
+ArrayStorage ArrayObject::storageFor(const Type& type) {
+    if (!type->isArray()) return ArrayStorage::VALUE;
+
+    Type elementType = type->as<ArrayType>()->getElementType();
+    if (elementType->isInt()) return ArrayStorage::INT;
+    if (elementType->isFloat()) return ArrayStorage::FLOAT;
+    if (elementType->isBool()) return ArrayStorage::BOOL;
+    return ArrayStorage::VALUE;
+}
+
+size_t ArrayObject::length() const {
+    return m_length;
+}
+
+ArrayStorage ArrayObject::getStorage() const {
+    return m_storage;
+}
+
+size_t ArrayObject::getAllocatedBytes() const {
+    return wordCount(m_storage, m_length) * sizeof(uint64_t);
+}
+
+void ArrayObject::fill(Value value) {
+    switch (m_storage) {
+        case ArrayStorage::INT:
+            std::fill_n(getData<int32_t>(), m_length, value.asInt());
+            break;
+        case ArrayStorage::FLOAT:
+            std::fill_n(getData<double>(), m_length,
+                        value.isDouble() ? value.asDouble() : static_cast<double>(value.asInt()));
+            break;
+        case ArrayStorage::BOOL: {
+            uint64_t* words = getData<uint64_t>();
+            std::fill_n(words, wordCount(m_storage, m_length), value.asBool() ? ~uint64_t{0} : 0);
+
+            // The bits past the end stay zero.
+            if (value.asBool() && m_length % 64 != 0) {
+                words[m_length / 64] = (uint64_t{1} << (m_length % 64)) - 1;
+            }
+            break;
+        }
+        case ArrayStorage::VALUE:
+            std::fill_n(getData<Value>(), m_length, value);
+            break;
+    }
+}
+
+bool ArrayObject::operator==(const ArrayObject& array) const {
+    if (m_length != array.m_length) return false;
+
+    // Ints and bools can be compared a word at a time, since the unused bits of the last word are always
+    // zero. Floats have to follow the rules for NaN and negative zero.
+    if (m_storage == array.m_storage && (m_storage == ArrayStorage::INT || m_storage == ArrayStorage::BOOL)) {
+        return std::memcmp(m_data.get(), array.m_data.get(), getAllocatedBytes()) == 0;
+    }
+
+    for (size_t i = 0; i < m_length; ++i) {
+        if (!(get(i) == array.get(i))) return false;
+    }
+
+    return true;
 }
 
 std::string ArrayObject::toString() const {
@@ -100,9 +310,9 @@ std::string ArrayObject::toString() const {
     std::string separator{};
 
     output << "[";
-    for (const Value& item : asVector()) {
+    for (size_t i = 0; i < m_length; ++i) {
         output << separator;
-        output << item.toString();
+        output << get(i).toString();
         separator = ", ";
     }
     output << "]";
@@ -114,8 +324,8 @@ Type ArrayObject::getType() const {
     return m_type;
 }
 
-ArrayObject* ArrayObject::clone() const {
-    return GC::allocateObject<ArrayObject>(*this);
+ArrayObject* ArrayObject::clone(Heap& heap) const {
+    return heap.allocateOldObject<ArrayObject>(*this);
 }
 
 UpvalueObject::UpvalueObject(uint32_t location) : Object{ObjectType::UPVALUE}, m_location{location} {
@@ -154,8 +364,8 @@ Type UpvalueObject::getType() const {
     return NOTHING_TYPE;
 }
 
-UpvalueObject* UpvalueObject::clone() const {
-    return GC::allocateObject<UpvalueObject>(*this);
+UpvalueObject* UpvalueObject::clone(Heap& heap) const {
+    return heap.allocateOldObject<UpvalueObject>(*this);
 }
 
 ClosureObject::ClosureObject(FunctionObject *function) : Object{ObjectType::CLOSURE}, m_function{function}, m_upvalues{function->getUpvalueCount()} {
@@ -177,8 +387,8 @@ Type ClosureObject::getType() const {
     return m_function->getType();
 }
 
-ClosureObject* ClosureObject::clone() const {
-    return GC::allocateObject<ClosureObject>(*this);
+ClosureObject* ClosureObject::clone(Heap& heap) const {
+    return heap.allocateOldObject<ClosureObject>(*this);
 }
 
 FunctionObject::FunctionObject(Type type, Chunk chunk, std::string name) :
@@ -212,8 +422,8 @@ Type FunctionObject::getType() const {
     return m_type;
 }
 
-FunctionObject* FunctionObject::clone() const {
-    return GC::allocateObject<FunctionObject>(*this);
+FunctionObject* FunctionObject::clone(Heap& heap) const {
+    return heap.allocateOldObject<FunctionObject>(*this);
 }
 
 NativeObject::NativeObject(Type type, NativeFn function) : Object{ObjectType::NATIVE}, m_type{type}, m_function{function} {
@@ -233,8 +443,8 @@ Type NativeObject::getType() const {
     return m_type;
 }
 
-NativeObject* NativeObject::clone() const {
-    return GC::allocateObject<NativeObject>(*this);
+NativeObject* NativeObject::clone(Heap& heap) const {
+    return heap.allocateOldObject<NativeObject>(*this);
 }
 
 TypeObject::TypeObject(Type containedType) : Object{ObjectType::TYPE}, m_containedType{containedType} {
@@ -252,6 +462,6 @@ Type TypeObject::getType() const {
     return NOTHING_TYPE;
 }
 
-TypeObject* TypeObject::clone() const {
-    return GC::allocateObject<TypeObject>(*this);
+TypeObject* TypeObject::clone(Heap& heap) const {
+    return heap.allocateOldObject<TypeObject>(*this);
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "h/ObjectPool.h"
+
+#include <new>
+
+ObjectPool::~ObjectPool() {
+    releaseAll();
+}
+
+size_t ObjectPool::sizeClassIndex(size_t size) {
+    return (size - 1) / SIZE_CLASS_GRANULARITY;
+}
+
+size_t ObjectPool::slotSize(size_t index) {
+    return (index + 1) * SIZE_CLASS_GRANULARITY;
+}
+
+ObjectPool::Page* ObjectPool::pageOf(void* slot) {
+    return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(slot) & ~(PAGE_SIZE - 1));
+}
+
+void ObjectPool::addPage(SizeClass& sizeClass, size_t slotSize) {
+    auto* memory = static_cast<uint8_t*>(::operator new(PAGE_SIZE, std::align_val_t{PAGE_SIZE}));
+
+    auto* page = new (memory) Page{0};
+    sizeClass.pages.push_back(page);
+
+    sizeClass.unusedBegin = memory + PAGE_HEADER_SIZE;
+    sizeClass.unusedEnd = sizeClass.unusedBegin + (PAGE_SIZE - PAGE_HEADER_SIZE) / slotSize * slotSize;
+}
+
+void* ObjectPool::allocate(size_t size) {
+    if (size > MAX_SLOT_SIZE) {
+        return ::operator new(size);
+    }
+
+    size_t index = sizeClassIndex(size);
+    SizeClass& sizeClass = m_sizeClasses[index];
+
+    void* slot;
+    if (sizeClass.freeList != nullptr) {
+        slot = sizeClass.freeList;
+        sizeClass.freeList = sizeClass.freeList->next;
+    } else {
+        if (sizeClass.unusedBegin == sizeClass.unusedEnd) {
+            addPage(sizeClass, slotSize(index));
+        }
+
+        slot = sizeClass.unusedBegin;
+        sizeClass.unusedBegin += slotSize(index);
+    }
+
+    ++pageOf(slot)->usedSlots;
+    ++sizeClass.usedSlots;
+
+    return slot;
+}
+
+void ObjectPool::free(void* memory, size_t size) {
+    if (size > MAX_SLOT_SIZE) {
+        ::operator delete(memory);
+        return;
+    }
+
+    SizeClass& sizeClass = m_sizeClasses[sizeClassIndex(size)];
+
+    --pageOf(memory)->usedSlots;
+    --sizeClass.usedSlots;
+
+    sizeClass.freeList = new (memory) FreeSlot{sizeClass.freeList};
+}
+
+void ObjectPool::releaseAll() {
+    for (SizeClass& sizeClass : m_sizeClasses) {
+        for (Page* page : sizeClass.pages) {
+            ::operator delete(page, std::align_val_t{PAGE_SIZE});
+        }
+
+        sizeClass = SizeClass{};
+    }
+}
+
+std::vector<ObjectPool::SizeClassStats> ObjectPool::getStats() const {
+    std::vector<SizeClassStats> stats;
+
+    for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+        const SizeClass& sizeClass = m_sizeClasses[i];
+        if (sizeClass.pages.empty()) continue;
+
+        SizeClassStats classStats{slotSize(i), (PAGE_SIZE - PAGE_HEADER_SIZE) / slotSize(i), sizeClass.usedSlots, {}};
+        for (const Page* page : sizeClass.pages) {
+            classStats.pageOccupancy.push_back(page->usedSlots);
+        }
+
+        stats.push_back(std::move(classStats));
+    }
+
+    return stats;
+}
@@ -0,0 +1,578 @@
+#include <algorithm>
+#include <limits>
+#include "h/Optimizer.h"
+#include "h/Enact.h"
+
+static bool isJump(OpCode op) {
+    return op == OpCode::JUMP || op == OpCode::JUMP_IF_TRUE || op == OpCode::JUMP_IF_FALSE || op == OpCode::LOOP ||
+            op == OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE;
+}
+
+static bool isUnconditionalJump(OpCode op) {
+    return op == OpCode::JUMP || op == OpCode::LOOP;
+}
+
+static bool isAnyOf(OpCode op, std::initializer_list<OpCode> ops) {
+    return std::find(ops.begin(), ops.end(), op) != ops.end();
+}
+
+static bool isNumeric(const Value& value) {
+    return value.isInt() || value.isDouble();
+}
+
+// Applies a binary operator to two constants, mirroring what the VM would do at runtime.
+template <typename A, typename B>
+static std::optional<Value> applyOp(OpCode op, A a, B b) {
+    switch (op) {
+        case OpCode::ADD: return Value{a + b};
+        case OpCode::SUBTRACT: return Value{a - b};
+        case OpCode::MULTIPLY: return Value{a * b};
+        case OpCode::DIVIDE:
+            // Leave integer divisions that would trap, by zero or of INT_MIN by -1, for the VM to deal with.
+            if constexpr (std::is_integral_v<A> && std::is_integral_v<B>) {
+                if (b == 0 || (b == -1 && a == std::numeric_limits<A>::min())) return std::nullopt;
+            }
+            return Value{a / b};
+        case OpCode::LESS: return Value{a < b};
+        case OpCode::GREATER: return Value{a > b};
+        case OpCode::LESS_EQUAL_INT: return Value{a <= b};
+        case OpCode::GREATER_EQUAL_INT: return Value{a >= b};
+        default: return std::nullopt;
+    }
+}
+
+static std::optional<Value> foldBinary(OpCode op, Value a, Value b) {
+    if (!isNumeric(a) || !isNumeric(b)) return std::nullopt;
+
+    OpCode generic;
+    switch (op) {
+        case OpCode::ADD_INT: case OpCode::ADD_FLOAT: generic = OpCode::ADD; break;
+        case OpCode::SUBTRACT_INT: case OpCode::SUBTRACT_FLOAT: generic = OpCode::SUBTRACT; break;
+        case OpCode::MULTIPLY_INT: case OpCode::MULTIPLY_FLOAT: generic = OpCode::MULTIPLY; break;
+        case OpCode::DIVIDE_INT: case OpCode::DIVIDE_FLOAT: generic = OpCode::DIVIDE; break;
+        case OpCode::LESS_INT: case OpCode::LESS_FLOAT: generic = OpCode::LESS; break;
+        case OpCode::GREATER_INT: case OpCode::GREATER_FLOAT: generic = OpCode::GREATER; break;
+        default: generic = op; break;
+    }
+
+    if (a.isInt() && b.isInt()) return applyOp(generic, a.asInt(), b.asInt());
+    if (a.isDouble() && b.isDouble()) return applyOp(generic, a.asDouble(), b.asDouble());
+
+    // Only the generic opcodes accept mixed operands.
+    if (generic != op) return std::nullopt;
+    if (a.isInt()) return applyOp(generic, a.asInt(), b.asDouble());
+    return applyOp(generic, a.asDouble(), b.asInt());
+}
+
+void Optimizer::optimize(FunctionObject* function) {
+    optimizeChunk(function->getChunk(), function->getName().empty() ? "script" : function->getName());
+
+    for (const Value& constant : function->getChunk().getConstants()) {
+        if (constant.isObject() && constant.asObject()->is<FunctionObject>()) {
+            optimize(constant.asObject()->as<FunctionObject>());
+        }
+    }
+}
+
+size_t Optimizer::getInstructionsBefore() const {
+    return m_instructionsBefore;
+}
+
+size_t Optimizer::getInstructionsAfter() const {
+    return m_instructionsAfter;
+}
+
+void Optimizer::optimizeChunk(Chunk& chunk, const std::string& name) {
+    decode(chunk);
+    size_t before = m_instructions.size();
+
+    // Jump threading can keep rewriting a cycle of jumps forever, so give up after a while.
+    constexpr size_t MAX_PASSES = 8;
+
+    bool changed = true;
+    for (size_t pass = 0; changed && pass < MAX_PASSES; ++pass) {
+        changed = false;
+
+        findJumpTargets();
+        changed |= foldConstants();
+        findJumpTargets();
+        changed |= removeRedundantChecks();
+        findJumpTargets();
+        changed |= fuseComparisons();
+        findJumpTargets();
+        changed |= removeDeadPushes();
+        findJumpTargets();
+        changed |= threadJumps();
+
+        compact();
+    }
+
+    // The other passes don't know about superinstructions, so they are only formed once everything else is done.
+    findJumpTargets();
+    if (fuseSuperinstructions()) {
+        compact();
+    }
+
+    std::optional<Chunk> optimized = encode();
+    if (!optimized) {
+        // A threaded jump ended up too far away to encode, so keep the original code.
+        decode(chunk);
+    } else {
+        chunk = std::move(*optimized);
+    }
+
+    m_instructionsBefore += before;
+    m_instructionsAfter += m_instructions.size();
+
+    if (Enact::getFlags().flagEnabled(Flag::DEBUG_LOG_OPTIMIZER)) {
+        std::cout << "-- OPTIMIZER: " << name << ": " << before << " instructions before, " <<
+                m_instructions.size() << " after.\n";
+    }
+}
+
+void Optimizer::decode(Chunk& chunk) {
+    m_chunk = &chunk;
+    m_instructions.clear();
+
+    const std::vector<uint8_t>& code = chunk.getCode();
+
+    std::unordered_map<size_t, size_t> indices;
+    std::vector<size_t> targetOffsets;
+
+    for (size_t offset = 0; offset < code.size();) {
+        size_t size = chunk.getInstructionSize(offset);
+        auto op = static_cast<OpCode>(code[offset]);
+
+        // The jump distance is always the last operand, and is replaced by the target index.
+        size_t operandsEnd = offset + size;
+        size_t targetOffset = 0;
+        if (isJump(op)) {
+            operandsEnd -= 2;
+            size_t distance = code[operandsEnd] | (code[operandsEnd + 1] << 8);
+            targetOffset = op == OpCode::LOOP ? offset + size - distance : offset + size + distance;
+        }
+
+        indices.insert(std::pair(offset, m_instructions.size()));
+        targetOffsets.push_back(targetOffset);
+
+        m_instructions.push_back(Instruction{
+                op,
+                std::vector<uint8_t>{code.begin() + offset + 1, code.begin() + operandsEnd},
+                chunk.getLine(offset),
+                0,
+                false
+        });
+
+        offset += size;
+    }
+
+    // Jumps past the last instruction are represented by a target of m_instructions.size().
+    indices.insert(std::pair(code.size(), m_instructions.size()));
+
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        if (isJump(m_instructions[i].op)) {
+            m_instructions[i].target = indices.at(targetOffsets[i]);
+        }
+    }
+}
+
+std::optional<Chunk> Optimizer::encode() const {
+    std::vector<size_t> offsets;
+    size_t offset = 0;
+    for (const Instruction& instruction : m_instructions) {
+        offsets.push_back(offset);
+        offset += 1 + instruction.operands.size() + (isJump(instruction.op) ? 2 : 0);
+    }
+    offsets.push_back(offset);
+
+    Chunk chunk{};
+    for (const Value& constant : m_chunk->getConstants()) {
+        chunk.addConstant(constant);
+    }
+
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        const Instruction& instruction = m_instructions[i];
+
+        if (!isJump(instruction.op)) {
+            chunk.write(instruction.op, instruction.line);
+            for (uint8_t byte : instruction.operands) {
+                chunk.write(byte, instruction.line);
+            }
+            continue;
+        }
+
+        bool isBackwards = instruction.target <= i;
+        if (isBackwards && !isUnconditionalJump(instruction.op)) return std::nullopt;
+
+        OpCode op = instruction.op;
+        if (isUnconditionalJump(op)) {
+            op = isBackwards ? OpCode::LOOP : OpCode::JUMP;
+        }
+
+        size_t from = offsets[i + 1];
+        size_t distance = isBackwards ? from - offsets[instruction.target] : offsets[instruction.target] - from;
+        if (distance > UINT16_MAX) return std::nullopt;
+
+        chunk.write(op, instruction.line);
+        for (uint8_t byte : instruction.operands) {
+            chunk.write(byte, instruction.line);
+        }
+        chunk.writeShort(static_cast<uint32_t>(distance), instruction.line);
+    }
+
+    chunk.computeMaxStackDepth();
+    return chunk;
+}
+
+void Optimizer::findJumpTargets() {
+    m_isJumpTarget.assign(m_instructions.size() + 1, false);
+    for (const Instruction& instruction : m_instructions) {
+        if (!instruction.removed && isJump(instruction.op)) {
+            m_isJumpTarget[instruction.target] = true;
+        }
+    }
+}
+
+void Optimizer::compact() {
+    // Jumps to a removed instruction now go to the next instruction that is still there.
+    std::vector<size_t> newIndices;
+    std::vector<Instruction> instructions;
+
+    for (Instruction& instruction : m_instructions) {
+        newIndices.push_back(instructions.size());
+        if (!instruction.removed) {
+            instructions.push_back(std::move(instruction));
+        }
+    }
+    newIndices.push_back(instructions.size());
+
+    for (Instruction& instruction : instructions) {
+        if (isJump(instruction.op)) {
+            instruction.target = newIndices[instruction.target];
+        }
+    }
+
+    m_instructions = std::move(instructions);
+}
+
+size_t Optimizer::next(size_t index) const {
+    do {
+        ++index;
+    } while (index < m_instructions.size() && m_instructions[index].removed);
+
+    return index;
+}
+
+std::optional<Value> Optimizer::getConstant(size_t index) const {
+    const Instruction& instruction = m_instructions[index];
+    const std::vector<uint8_t>& operands = instruction.operands;
+
+    switch (instruction.op) {
+        case OpCode::CONSTANT: return m_chunk->getConstants()[operands[0]];
+        case OpCode::CONSTANT_LONG:
+            return m_chunk->getConstants()[operands[0] | (operands[1] << 8) | (operands[2] << 16)];
+        case OpCode::TRUE: return Value{true};
+        case OpCode::FALSE: return Value{false};
+        default: return std::nullopt;
+    }
+}
+
+void Optimizer::setConstant(size_t index, Value value) {
+    Instruction& instruction = m_instructions[index];
+
+    if (value.isBool()) {
+        instruction.op = value.asBool() ? OpCode::TRUE : OpCode::FALSE;
+        instruction.operands.clear();
+        return;
+    }
+
+    size_t constant = m_chunk->addConstant(value);
+    if (constant < UINT8_MAX) {
+        instruction.op = OpCode::CONSTANT;
+        instruction.operands = {static_cast<uint8_t>(constant)};
+    } else {
+        instruction.op = OpCode::CONSTANT_LONG;
+        instruction.operands = {
+                static_cast<uint8_t>(constant & 0xff),
+                static_cast<uint8_t>((constant >> 8) & 0xff),
+                static_cast<uint8_t>((constant >> 16) & 0xff),
+        };
+    }
+}
+
+bool Optimizer::foldConstants() {
+    bool changed = false;
+
+    for (size_t a = 0; a < m_instructions.size(); a = next(a)) {
+        if (m_instructions[a].removed) continue;
+
+        std::optional<Value> left = getConstant(a);
+        if (!left) continue;
+
+        size_t b = next(a);
+        if (b >= m_instructions.size() || m_isJumpTarget[b]) continue;
+
+        // Unary operators on a single constant.
+        if (m_instructions[b].op == OpCode::NEGATE && isNumeric(*left)) {
+            setConstant(a, left->isInt() ? Value{-left->asInt()} : Value{-left->asDouble()});
+            m_instructions[b].removed = true;
+            changed = true;
+            continue;
+        }
+        if (m_instructions[b].op == OpCode::NOT && left->isBool()) {
+            setConstant(a, Value{!left->asBool()});
+            m_instructions[b].removed = true;
+            changed = true;
+            continue;
+        }
+
+        std::optional<Value> right = getConstant(b);
+        if (!right) continue;
+
+        size_t op = next(b);
+        if (op >= m_instructions.size() || m_isJumpTarget[op]) continue;
+
+        std::optional<Value> result = foldBinary(m_instructions[op].op, *left, *right);
+        if (!result) continue;
+
+        setConstant(a, *result);
+        m_instructions[b].removed = true;
+        m_instructions[op].removed = true;
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool Optimizer::removeRedundantChecks() {
+    bool changed = false;
+
+    size_t previous = m_instructions.size();
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        Instruction& instruction = m_instructions[i];
+        if (instruction.removed) continue;
+
+        if (previous < m_instructions.size() && !m_isJumpTarget[i]) {
+            OpCode before = m_instructions[previous].op;
+            std::optional<Value> constant = getConstant(previous);
+
+            bool redundant = false;
+            switch (instruction.op) {
+                case OpCode::CHECK_INT:
+                    redundant = (constant && constant->isInt()) ||
+                            isAnyOf(before, {OpCode::CHECK_INT, OpCode::ADD_INT, OpCode::SUBTRACT_INT,
+                                             OpCode::MULTIPLY_INT, OpCode::DIVIDE_INT});
+                    break;
+                case OpCode::CHECK_NUMERIC:
+                    redundant = (constant && isNumeric(*constant)) ||
+                            isAnyOf(before, {OpCode::CHECK_NUMERIC, OpCode::CHECK_INT,
+                                             OpCode::ADD_INT, OpCode::SUBTRACT_INT,
+                                             OpCode::MULTIPLY_INT, OpCode::DIVIDE_INT,
+                                             OpCode::ADD_FLOAT, OpCode::SUBTRACT_FLOAT,
+                                             OpCode::MULTIPLY_FLOAT, OpCode::DIVIDE_FLOAT});
+                    break;
+                case OpCode::CHECK_STRING:
+                    redundant = (constant && constant->isObject() && constant->asObject()->isString()) ||
+                            isAnyOf(before, {OpCode::CHECK_STRING, OpCode::CONCATENATE});
+                    break;
+                case OpCode::CHECK_BOOL:
+                    redundant = (constant && constant->isBool()) ||
+                            isAnyOf(before, {OpCode::CHECK_BOOL, OpCode::NOT, OpCode::EQUAL,
+                                             OpCode::LESS, OpCode::GREATER,
+                                             OpCode::LESS_INT, OpCode::GREATER_INT,
+                                             OpCode::LESS_EQUAL_INT, OpCode::GREATER_EQUAL_INT,
+                                             OpCode::LESS_FLOAT, OpCode::GREATER_FLOAT});
+                    break;
+                default:
+                    break;
+            }
+
+            if (redundant) {
+                instruction.removed = true;
+                changed = true;
+                continue;
+            }
+        }
+
+        previous = i;
+    }
+
+    return changed;
+}
+
+bool Optimizer::fuseComparisons() {
+    bool changed = false;
+
+    for (size_t i = 0; i < m_instructions.size(); i = next(i)) {
+        if (m_instructions[i].removed) continue;
+
+        size_t notIndex = next(i);
+        if (notIndex >= m_instructions.size() || m_isJumpTarget[notIndex]) continue;
+        if (m_instructions[notIndex].op != OpCode::NOT) continue;
+
+        // Only the int comparisons can be inverted: !(a > b) is not the same as a <= b when a or b is NaN.
+        OpCode& op = m_instructions[i].op;
+        switch (op) {
+            case OpCode::GREATER_INT: op = OpCode::LESS_EQUAL_INT; break;
+            case OpCode::LESS_INT: op = OpCode::GREATER_EQUAL_INT; break;
+            case OpCode::LESS_EQUAL_INT: op = OpCode::GREATER_INT; break;
+            case OpCode::GREATER_EQUAL_INT: op = OpCode::LESS_INT; break;
+            case OpCode::NOT:
+                // A double negation does nothing at all.
+                m_instructions[i].removed = true;
+                break;
+            default:
+                continue;
+        }
+
+        m_instructions[notIndex].removed = true;
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool Optimizer::removeDeadPushes() {
+    bool changed = false;
+
+    for (size_t i = 0; i < m_instructions.size(); i = next(i)) {
+        if (m_instructions[i].removed) continue;
+
+        switch (m_instructions[i].op) {
+            case OpCode::CONSTANT:
+            case OpCode::CONSTANT_LONG:
+            case OpCode::TRUE:
+            case OpCode::FALSE:
+            case OpCode::NIL:
+            case OpCode::GET_LOCAL:
+            case OpCode::GET_LOCAL_LONG:
+            case OpCode::GET_UPVALUE:
+            case OpCode::GET_UPVALUE_LONG:
+                break;
+            default:
+                continue;
+        }
+
+        size_t pop = next(i);
+        if (pop >= m_instructions.size() || m_isJumpTarget[pop] || m_instructions[pop].op != OpCode::POP) continue;
+
+        m_instructions[i].removed = true;
+        m_instructions[pop].removed = true;
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool Optimizer::threadJumps() {
+    // Chains longer than this are most likely infinite loops.
+    constexpr size_t MAX_HOPS = 16;
+
+    bool changed = false;
+
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        Instruction& jump = m_instructions[i];
+        if (jump.removed || !isJump(jump.op)) continue;
+
+        for (size_t hops = 0; hops < MAX_HOPS && jump.target < m_instructions.size(); ++hops) {
+            const Instruction& destination = m_instructions[jump.target];
+            if (destination.removed) break;
+
+            size_t newTarget;
+            if (isUnconditionalJump(destination.op)) {
+                newTarget = destination.target;
+            } else if (destination.op == jump.op &&
+                       (jump.op == OpCode::JUMP_IF_TRUE || jump.op == OpCode::JUMP_IF_FALSE)) {
+                // The same condition is still on top of the stack, so the second jump is taken as well.
+                newTarget = destination.target;
+            } else if ((jump.op == OpCode::JUMP_IF_TRUE && destination.op == OpCode::JUMP_IF_FALSE) ||
+                       (jump.op == OpCode::JUMP_IF_FALSE && destination.op == OpCode::JUMP_IF_TRUE)) {
+                // ...and here it is never taken.
+                newTarget = next(jump.target);
+            } else {
+                break;
+            }
+
+            // Conditional jumps can only go forwards.
+            if (newTarget == jump.target || (!isUnconditionalJump(jump.op) && newTarget <= i)) break;
+
+            jump.target = newTarget;
+            changed = true;
+        }
+
+        // A jump to the very next instruction does nothing, whether it's taken or not.
+        if (jump.target == next(i) && jump.target > i) {
+            jump.removed = true;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+bool Optimizer::fuseSuperinstructions() {
+    // The longest sequence that gets fused.
+    constexpr size_t MAX_LENGTH = 5;
+
+    bool changed = false;
+
+    for (size_t i = 0; i < m_instructions.size(); i = next(i)) {
+        if (m_instructions[i].removed || m_instructions[i].op != OpCode::GET_LOCAL) continue;
+
+        // Only the first instruction of a sequence may be jumped to.
+        std::vector<size_t> sequence{i};
+        for (size_t j = next(i); sequence.size() < MAX_LENGTH && j < m_instructions.size() && !m_isJumpTarget[j];
+                j = next(j)) {
+            sequence.push_back(j);
+        }
+
+        auto matches = [&](std::initializer_list<OpCode> ops) {
+            return ops.size() <= sequence.size() &&
+                    std::equal(ops.begin(), ops.end(), sequence.begin(), [&](OpCode op, size_t index) {
+                        return m_instructions[index].op == op;
+                    });
+        };
+
+        if (sequence.size() < 3 || m_instructions[sequence[1]].op != OpCode::CONSTANT) continue;
+        if (!getConstant(sequence[1])->isInt()) continue;
+
+        Instruction& first = m_instructions[i];
+        uint8_t slot = first.operands[0];
+        uint8_t constant = m_instructions[sequence[1]].operands[0];
+
+        size_t length;
+        if (matches({OpCode::GET_LOCAL, OpCode::CONSTANT, OpCode::ADD_INT, OpCode::SET_LOCAL, OpCode::POP}) &&
+                m_instructions[sequence[3]].operands[0] == slot && getConstant(sequence[1])->asInt() == 1) {
+            first.op = OpCode::INC_LOCAL;
+            first.operands = {slot};
+            length = 5;
+        } else if (matches({OpCode::GET_LOCAL, OpCode::CONSTANT, OpCode::LESS_INT, OpCode::JUMP_IF_FALSE, OpCode::POP})) {
+            // Both paths of the original sequence pop the condition, but the superinstruction never pushes it.
+            // That only works out if the jump lands on a POP, which it then has to skip.
+            size_t target = m_instructions[sequence[3]].target;
+            if (target >= m_instructions.size() || m_instructions[target].op != OpCode::POP) continue;
+
+            first.op = OpCode::LESS_LOCAL_CONSTANT_JUMP_IF_FALSE;
+            first.operands = {slot, constant};
+            first.target = next(target);
+            length = 5;
+        } else if (matches({OpCode::GET_LOCAL, OpCode::CONSTANT, OpCode::ADD_INT})) {
+            first.op = OpCode::ADD_LOCAL_CONSTANT;
+            first.operands = {slot, constant};
+            length = 3;
+        } else if (matches({OpCode::GET_LOCAL, OpCode::CONSTANT, OpCode::SUBTRACT_INT})) {
+            first.op = OpCode::SUBTRACT_LOCAL_CONSTANT;
+            first.operands = {slot, constant};
+            length = 3;
+        } else {
+            continue;
+        }
+
+        for (size_t n = 1; n < length; ++n) {
+            m_instructions[sequence[n]].removed = true;
+        }
+        changed = true;
+    }
+
+    return changed;
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include "h/Profiler.h"
+#include "h/Enact.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define ENACT_PROFILER_RDTSC
+#endif
+
+// How many rows each table in the report has. The JSON dump always has all of them.
+constexpr size_t REPORT_ROWS = 20;
+
+uint64_t Profiler::readCycles() {
+#ifdef ENACT_PROFILER_RDTSC
+    return __rdtsc();
+#else
+    // Without a cycle counter, nanoseconds are the next best thing.
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void Profiler::recordInstruction(FunctionObject* function, size_t offset) {
+    // The counter is only read once per instruction, so our own bookkeeping is charged to the previous one.
+    uint64_t now = readCycles();
+    charge(now);
+    m_start = now;
+
+    if (function != m_currentFunctionObject) {
+        auto [it, inserted] = m_functions.try_emplace(function);
+        if (inserted) {
+            it->second.name = function->getName().empty() ? "<script>" : function->getName();
+            it->second.instructions.resize(function->getChunk().getCount());
+        }
+
+        m_currentFunctionObject = function;
+        m_currentFunction = &it->second;
+    }
+
+    m_currentOpCode = &m_opCodes[function->getChunk().getCode()[offset]];
+    m_currentInstruction = &m_currentFunction->instructions[offset];
+
+    ++m_currentOpCode->count;
+    ++m_currentInstruction->count;
+    ++m_currentFunction->total.count;
+}
+
+void Profiler::stop() {
+    charge(readCycles());
+
+    m_currentFunctionObject = nullptr;
+    m_currentFunction = nullptr;
+    m_currentOpCode = nullptr;
+    m_currentInstruction = nullptr;
+}
+
+void Profiler::charge(uint64_t now) {
+    if (m_currentOpCode == nullptr) return;
+
+    uint64_t cycles = now - m_start;
+    m_currentOpCode->cycles += cycles;
+    m_currentInstruction->cycles += cycles;
+    m_currentFunction->total.cycles += cycles;
+}
+
+Profiler::Counter Profiler::getTotal() const {
+    Counter total{};
+    for (const Counter& counter : m_opCodes) {
+        total.count += counter.count;
+        total.cycles += counter.cycles;
+    }
+
+    return total;
+}
+
+std::vector<Profiler::Row> Profiler::getOpCodeRows() const {
+    std::vector<Row> rows;
+    for (size_t i = 0; i < OPCODE_COUNT; ++i) {
+        if (m_opCodes[i].count == 0) continue;
+        rows.push_back(Row{opCodeToString(static_cast<OpCode>(i)), m_opCodes[i]});
+    }
+
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.counter.cycles > b.counter.cycles;
+    });
+    return rows;
+}
+
+std::vector<Profiler::Row> Profiler::getFunctionRows() const {
+    std::vector<Row> rows;
+    for (const auto& [function, profile] : m_functions) {
+        rows.push_back(Row{profile.name, profile.total});
+    }
+
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.counter.cycles > b.counter.cycles;
+    });
+    return rows;
+}
+
+std::vector<std::pair<line_t, Profiler::Counter>> Profiler::getLineCounters() const {
+    std::map<line_t, Counter> lines;
+    for (const auto& [function, profile] : m_functions) {
+        const Chunk& chunk = function->getChunk();
+        for (size_t offset = 0; offset < profile.instructions.size(); ++offset) {
+            const Counter& counter = profile.instructions[offset];
+            if (counter.count == 0) continue;
+
+            Counter& line = lines[chunk.getLine(offset)];
+            line.count += counter.count;
+            line.cycles += counter.cycles;
+        }
+    }
+
+    std::vector<std::pair<line_t, Counter>> rows{lines.begin(), lines.end()};
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+        return a.second.cycles > b.second.cycles;
+    });
+    return rows;
+}
+
+static void printHeader(std::ostream& stream, const std::string& title) {
+    stream << "-- " << title << ":\n";
+    stream << std::right << std::setw(14) << "count" << std::setw(16) << "cycles" << std::setw(9) << "%" << "  " <<
+            "name\n";
+}
+
+static void printRow(std::ostream& stream, const std::string& name, uint64_t count, uint64_t cycles,
+        uint64_t totalCycles) {
+    double percentage = totalCycles == 0 ? 0.0 : 100.0 * cycles / totalCycles;
+    stream << std::right << std::setw(14) << count << std::setw(16) << cycles <<
+            std::setw(8) << std::fixed << std::setprecision(2) << percentage << "%  " << name << "\n";
+}
+
+void Profiler::printReport(std::ostream& stream) const {
+    std::ios_base::fmtflags f( stream.flags() );
+
+    Counter total = getTotal();
+    stream << "-- PROFILE: " << total.count << " instructions, " << total.cycles << " cycles.\n";
+
+    std::vector<Row> opCodes = getOpCodeRows();
+    printHeader(stream, "opcodes");
+    for (size_t i = 0; i < opCodes.size() && i < REPORT_ROWS; ++i) {
+        printRow(stream, opCodes[i].name, opCodes[i].counter.count, opCodes[i].counter.cycles, total.cycles);
+    }
+
+    std::vector<Row> functions = getFunctionRows();
+    printHeader(stream, "functions");
+    for (size_t i = 0; i < functions.size() && i < REPORT_ROWS; ++i) {
+        printRow(stream, functions[i].name, functions[i].counter.count, functions[i].counter.cycles, total.cycles);
+    }
+
+    std::vector<std::pair<line_t, Counter>> lines = getLineCounters();
+    printHeader(stream, "lines");
+    for (size_t i = 0; i < lines.size() && i < REPORT_ROWS; ++i) {
+        auto [line, counter] = lines[i];
+        printRow(stream, std::to_string(line) + ": " + Enact::getSourceLine(line), counter.count, counter.cycles,
+                total.cycles);
+    }
+
+    stream.flags(f);
+}
+
+void Profiler::writeJson(std::ostream& stream) const {
+    Counter total = getTotal();
+    stream << "{\n";
+    stream << "  \"instructions\": " << total.count << ",\n";
+    stream << "  \"cycles\": " << total.cycles << ",\n";
+
+    // Opcode and function names are plain identifiers, so they never need escaping.
+    auto writeRows = [&stream](const std::string& key, const std::vector<Row>& rows) {
+        stream << "  \"" << key << "\": [";
+        for (size_t i = 0; i < rows.size(); ++i) {
+            stream << (i == 0 ? "\n" : ",\n");
+            stream << "    {\"name\": \"" << rows[i].name << "\", \"count\": " << rows[i].counter.count <<
+                    ", \"cycles\": " << rows[i].counter.cycles << "}";
+        }
+        stream << "\n  ],\n";
+    };
+
+    writeRows("opcodes", getOpCodeRows());
+    writeRows("functions", getFunctionRows());
+
+    std::vector<std::pair<line_t, Counter>> lines = getLineCounters();
+    stream << "  \"lines\": [";
+    for (size_t i = 0; i < lines.size(); ++i) {
+        stream << (i == 0 ? "\n" : ",\n");
+        stream << "    {\"line\": " << lines[i].first << ", \"count\": " << lines[i].second.count <<
+                ", \"cycles\": " << lines[i].second.cycles << "}";
+    }
+    stream << "\n  ]\n";
+
+    stream << "}\n";
+}
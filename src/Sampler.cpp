@@ -0,0 +1,167 @@
+#include "h/Sampler.h"
+
+#ifdef ENACT_SAMPLING_ENABLED
+#include <csignal>
+#include <sys/time.h>
+#endif
+
+std::atomic<Sampler*> Sampler::m_current{nullptr};
+
+Sampler::Sampler() : m_buffer{new Sample[BUFFER_CAPACITY]} {}
+
+Sampler::~Sampler() {
+    stop();
+}
+
+bool Sampler::start(const VM& vm) {
+#ifdef ENACT_SAMPLING_ENABLED
+    m_vm = &vm;
+    m_current.store(this);
+
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_running = true;
+    }
+
+    // The drain thread inherits our signal mask, so block SIGPROF while it is created. That way
+    // the signal is always delivered to the thread running the VM.
+    sigset_t profSignal;
+    sigset_t oldMask;
+    sigemptyset(&profSignal);
+    sigaddset(&profSignal, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profSignal, &oldMask);
+    m_drainThread = std::thread{&Sampler::drainLoop, this};
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+    struct sigaction action{};
+    action.sa_handler = &Sampler::handleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    itimerval timer{};
+    timer.it_interval.tv_usec = SAMPLE_INTERVAL_US;
+    timer.it_value.tv_usec = SAMPLE_INTERVAL_US;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Sampler::stop() {
+#ifdef ENACT_SAMPLING_ENABLED
+    if (m_current.load() != this) return;
+
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+
+    signal(SIGPROF, SIG_IGN);
+    m_current.store(nullptr);
+
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_running = false;
+    }
+    m_wakeUp.notify_one();
+    m_drainThread.join();
+
+    // Pick up whatever arrived after the drain thread's last pass.
+    drain();
+#endif
+}
+
+void Sampler::handleSignal(int) {
+    Sampler* sampler = m_current.load(std::memory_order_acquire);
+    if (sampler != nullptr) {
+        sampler->takeSample();
+    }
+}
+
+void Sampler::takeSample() {
+    // This runs inside of the signal handler: no allocation, no locks and no I/O.
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == BUFFER_CAPACITY) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Sample& sample = m_buffer[head & (BUFFER_CAPACITY - 1)];
+    sample.depth = 0;
+
+    size_t frameCount = m_vm->m_frameCount;
+    for (size_t i = 0; i < frameCount && i < FRAMES_MAX; ++i) {
+        const CallFrame& frame = m_vm->m_frames[i];
+        if (frame.closure == nullptr || frame.ip == nullptr) break;
+
+        FunctionObject* function = frame.closure->getFunction();
+        const uint8_t* code = function->getChunk().getCode().data();
+
+        // ip has already moved past the opcode that is executing, or past the CALL in callers.
+        sample.functions[sample.depth] = function;
+        sample.offsets[sample.depth] = static_cast<uint32_t>(frame.ip > code ? frame.ip - code - 1 : 0);
+        ++sample.depth;
+    }
+
+    m_head.store(head + 1, std::memory_order_release);
+}
+
+void Sampler::drainLoop() {
+    // How often the ring buffer is emptied. It holds about a second worth of samples.
+    constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds{50};
+
+    std::unique_lock<std::mutex> lock{m_mutex};
+    while (m_running) {
+        m_wakeUp.wait_for(lock, DRAIN_INTERVAL);
+        drain();
+    }
+}
+
+void Sampler::drain() {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_acquire);
+
+    for (; tail != head; ++tail) {
+        const Sample& sample = m_buffer[tail & (BUFFER_CAPACITY - 1)];
+        if (sample.depth == 0) continue;
+
+        Stack stack;
+        for (size_t i = 0; i < sample.depth; ++i) {
+            stack.emplace_back(sample.functions[i], sample.offsets[i]);
+        }
+
+        ++m_stacks[stack];
+        ++m_sampleCount;
+    }
+
+    m_tail.store(tail, std::memory_order_release);
+}
+
+size_t Sampler::getSampleCount() const {
+    return m_sampleCount;
+}
+
+size_t Sampler::getDroppedCount() const {
+    return m_dropped.load();
+}
+
+void Sampler::writeFolded(std::ostream& stream) const {
+    // Samples that only differ in the instruction they were taken at still end up on the same line.
+    std::map<std::string, size_t> folded;
+
+    for (const auto& [stack, count] : m_stacks) {
+        std::string frames;
+        for (const auto& [function, offset] : stack) {
+            if (!frames.empty()) frames += ";";
+            frames += function->getName().empty() ? "<script>" : function->getName();
+            frames += ":" + std::to_string(function->getChunk().getLine(offset));
+        }
+
+        folded[frames] += count;
+    }
+
+    for (const auto& [frames, count] : folded) {
+        stream << frames << " " << count << "\n";
+    }
+}
@@ -0,0 +1,79 @@
+#include "h/StringTable.h"
+#include "h/Object.h"
+
+StringObject* StringTable::tombstone() {
+    static StringObject* const tombstone = reinterpret_cast<StringObject*>(alignof(StringObject));
+    return tombstone;
+}
+
+void StringTable::grow() {
+    size_t capacity = MIN_CAPACITY;
+    while (capacity < (m_size + 1) * 2) {
+        capacity *= 2;
+    }
+
+    std::vector<StringObject*> entries{capacity, nullptr};
+    for (StringObject* entry : m_entries) {
+        if (entry == nullptr || entry == tombstone()) continue;
+
+        size_t i = entry->getHash() & (capacity - 1);
+        while (entries[i] != nullptr) {
+            i = (i + 1) & (capacity - 1);
+        }
+        entries[i] = entry;
+    }
+
+    m_entries = std::move(entries);
+    m_used = m_size;
+}
+
+StringObject* StringTable::find(std::string_view chars, size_t hash) const {
+    if (m_entries.empty()) return nullptr;
+
+    size_t mask = m_entries.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        StringObject* entry = m_entries[i];
+
+        if (entry == nullptr) return nullptr;
+        if (entry != tombstone() && entry->getHash() == hash && entry->asStringView() == chars) return entry;
+    }
+}
+
+void StringTable::insert(StringObject* string) {
+    // Keep at least a quarter of the entries empty, so that every probe ends.
+    if ((m_used + 1) * 4 > m_entries.size() * 3) grow();
+
+    size_t mask = m_entries.size() - 1;
+    for (size_t i = string->getHash() & mask;; i = (i + 1) & mask) {
+        StringObject*& entry = m_entries[i];
+
+        if (entry == nullptr || entry == tombstone()) {
+            if (entry == nullptr) ++m_used;
+            ++m_size;
+
+            entry = string;
+            return;
+        }
+    }
+}
+
+void StringTable::removeUnmarked() {
+    for (StringObject*& entry : m_entries) {
+        if (entry == nullptr || entry == tombstone()) continue;
+
+        if (!entry->isMarked() && !entry->isShared()) {
+            entry = tombstone();
+            --m_size;
+        }
+    }
+}
+
+void StringTable::clear() {
+    m_entries.clear();
+    m_size = 0;
+    m_used = 0;
+}
+
+size_t StringTable::size() const {
+    return m_size;
+}
@@ -1,461 +1,850 @@
+#include <atomic>
 #include <sstream>
 #include "h/VM.h"
 #include "h/Enact.h"
-#include "h/GC.h"
+#include "h/Heap.h"
+#include "h/Natives.h"
+#include "h/Profiler.h"
 
-VM::VM() : m_stack{} {
-    GC::setVM(this);
+static bool isRope(Value value) {
+    return value.isObject() && value.asObject()->is<RopeObject>();
+}
+
+// The analyser lets ints into float variables, parameters and return values without converting them, so a value
+// of static type float may still hold an int.
+static inline double asFloat(Value value) {
+    return value.isInt() ? static_cast<double>(value.asInt()) : value.asDouble();
+}
+
+VM::VM(Heap& heap) : m_heap{heap}, m_stack{new Value[STACK_MAX]} {
+    m_stackTop = m_stack.get();
+    m_heap.setVM(this);
+}
+
+VM::~VM() {
+    m_heap.setVM(nullptr);
+}
+
+Heap& VM::getHeap() {
+    return m_heap;
 }
 
 InterpretResult VM::run(FunctionObject* function) {
-    push(Value{function});
-
-    CallFrame* frame = &m_frames[m_frameCount++];
-    frame->closure = GC::allocateObject<ClosureObject>(function);
-    pop();
-    push(Value{frame->closure});
-    frame->ip = function->getChunk().getCode().data();
-    frame->slotsBegin = 0;
-
-    for (;;) {
-        #define READ_BYTE() (*frame->ip++)
-        #define READ_SHORT() (static_cast<uint16_t>(READ_BYTE() | (READ_BYTE() << 8)))
-        #define READ_LONG() (static_cast<uint32_t>(READ_BYTE() | (READ_BYTE() << 8) | (READ_BYTE() << 16)))
-        #define READ_CONSTANT() ((frame->closure->getFunction()->getChunk().getConstants())[READ_BYTE()])
-        #define READ_CONSTANT_LONG() ((frame->closure->getFunction()->getChunk().getConstants())[READ_LONG()])
-        #define NUMERIC_OP(op) \
-            do { \
-                Value b = pop(); \
-                Value a = pop(); \
-                if (a.isInt() && b.isInt()) { \
-                    push(Value{a.asInt() op b.asInt()}); \
-                } else if (a.isDouble() && b.isDouble()) { \
-                    push(Value{a.asDouble() op b.asDouble()}); \
-                } else if (a.isInt() && b.isDouble()) { \
-                    push(Value{a.asInt() op b.asDouble()}); \
-                } else { \
-                    push(Value{a.asDouble() op b.asInt()}); \
-                } \
-            } while (false)
-
-        if (Enact::getFlags().flagEnabled(Flag::DEBUG_TRACE_EXECUTION)) {
-            std::cout << "    ";
-            for (Value value : m_stack) {
-                std::cout << "[ " << value << " ] ";
-            }
-            std::cout << "\n";
+    m_canQuicken = !function->isShared();
 
-            std::cout << frame->closure->getFunction()->getChunk()
-                    .disassembleInstruction(
-                            frame->ip - frame->closure->getFunction()->getChunk().getCode().data()).first;
+    InterpretResult result;
+    try {
+        push(Value{function});
+        ClosureObject* closure = m_heap.allocateObject<ClosureObject>(function);
+        pop();
+        push(Value{closure});
+
+        if (!call(closure)) {
+            return InterpretResult::RUNTIME_ERROR;
         }
 
-        Value* slots = &m_stack[frame->slotsBegin];
+        // Pick the interpreter specialization once, so the plain loop never checks the flags.
+        bool isTracing = Enact::getFlags().flagEnabled(Flag::DEBUG_TRACE_EXECUTION);
+        if (m_profiler == nullptr) {
+            return isTracing ? execute<true, false>() : execute<false, false>();
+        }
 
-        switch (static_cast<OpCode>(READ_BYTE())) {
-            case OpCode::CONSTANT: {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
+        result = isTracing ? execute<true, true>() : execute<false, true>();
+    } catch (const Heap::OutOfMemoryError& error) {
+        runtimeError(error.what());
+        result = InterpretResult::RUNTIME_ERROR;
+    } catch (const Natives::Error& error) {
+        runtimeError(error.what());
+        result = InterpretResult::RUNTIME_ERROR;
+    }
 
-            case OpCode::CONSTANT_LONG: {
-                Value constant = READ_CONSTANT_LONG();
-                push(constant);
-                break;
-            }
+    if (m_profiler != nullptr) {
+        m_profiler->stop();
+    }
+    return result;
+}
+
+void VM::setProfiler(Profiler* profiler) {
+    m_profiler = profiler;
+}
 
-            case OpCode::TRUE: push(Value{true}); break;
-            case OpCode::FALSE: push(Value{false}); break;
-            case OpCode::NIL: push(Value{}); break;
+template <bool isTracing, bool isProfiling>
+InterpretResult VM::execute() {
+    CallFrame* frame = &m_frames[m_frameCount - 1];
+    Value* slots = &m_stack[frame->slotsBegin];
+
+    // The stack top lives in a local while we're in the loop. It has to be written back with
+    // STORE_STACK() before anything outside of the loop looks at the stack (the GC, calls,
+    // upvalues, natives and tracing), and read again with LOAD_STACK() if that could change it.
+    Value* stackTop = m_stackTop;
+
+    #define READ_BYTE() (*frame->ip++)
+    // The operands of | may be evaluated in any order, so the bytes are read through ip after skipping them.
+    #define READ_SHORT() (frame->ip += 2, static_cast<uint16_t>(frame->ip[-2] | (frame->ip[-1] << 8)))
+    #define READ_LONG() \
+        (frame->ip += 3, static_cast<uint32_t>(frame->ip[-3] | (frame->ip[-2] << 8) | (frame->ip[-1] << 16)))
+    #define READ_CONSTANT() ((frame->closure->getFunction()->getChunk().getConstants())[READ_BYTE()])
+    #define READ_CONSTANT_LONG() ((frame->closure->getFunction()->getChunk().getConstants())[READ_LONG()])
+    #define PUSH(value) (*stackTop++ = (value))
+    #define POP() (*--stackTop)
+    // Pops a value that isn't needed.
+    #define DROP() (--stackTop)
+    #define PEEK(depth) (stackTop[-1 - static_cast<ptrdiff_t>(depth)])
+    #define STORE_STACK() (m_stackTop = stackTop)
+    #define LOAD_STACK() (stackTop = m_stackTop)
+    // Rewrites the instruction that is currently executing, which has no operands, to another opcode.
+    #define QUICKEN(opcode) \
+        do { \
+            if (m_canQuicken) { \
+                frame->closure->getFunction()->getChunk().rewrite( \
+                        frame->ip - 1 - frame->closure->getFunction()->getChunk().getCode().data(), opcode); \
+            } \
+        } while (false)
+    #define NUMERIC_OP(op, intQuick, floatQuick) \
+        do { \
+            Value b = POP(); \
+            Value a = POP(); \
+            if (a.isInt() && b.isInt()) { \
+                QUICKEN(OpCode::intQuick); \
+                PUSH(Value{a.asInt() op b.asInt()}); \
+            } else if (a.isDouble() && b.isDouble()) { \
+                QUICKEN(OpCode::floatQuick); \
+                PUSH(Value{a.asDouble() op b.asDouble()}); \
+            } else if (a.isInt() && b.isDouble()) { \
+                PUSH(Value{a.asInt() op b.asDouble()}); \
+            } else { \
+                PUSH(Value{a.asDouble() op b.asInt()}); \
+            } \
+        } while (false)
+    // The compiler can't tell whether two dynamic operands of + are numbers or strings, so ADD checks them itself.
+    #define ADD_OP() \
+        do { \
+            Value right = PEEK(0); \
+            Value left = PEEK(1); \
+            if ((left.isInt() || left.isDouble()) && (right.isInt() || right.isDouble())) { \
+                NUMERIC_OP(+, ADD_INT_QUICK, ADD_FLOAT_QUICK); \
+            } else if (left.isObject() && left.asObject()->isString() \
+                    && right.isObject() && right.asObject()->isString()) { \
+                STORE_STACK(); \
+                Object* result = m_heap.concatenate(PEEK(1), PEEK(0)); \
+                DROP(); \
+                PEEK(0) = Value{result}; \
+            } else { \
+                runtimeError("Can only add two numbers or two strings, but got values of type '" + \
+                        left.getType()->toString() + "' and '" + right.getType()->toString() + "' instead."); \
+                return InterpretResult::RUNTIME_ERROR; \
+            } \
+        } while (false)
+    #define INT_OP(op) \
+        do { \
+            int b = POP().asInt(); \
+            PEEK(0) = Value{PEEK(0).asInt() op b}; \
+        } while (false)
+    #define FLOAT_OP(op) \
+        do { \
+            double b = asFloat(POP()); \
+            PEEK(0) = Value{asFloat(PEEK(0)) op b}; \
+        } while (false)
+    // If the operands no longer have the types this form was specialized for, fall back to the generic
+    // opcode, which will specialize again if it can.
+    #define QUICK_OP(op, isType, typedOp, generic) \
+        do { \
+            if (PEEK(0).isType() && PEEK(1).isType()) { \
+                typedOp(op); \
+            } else { \
+                QUICKEN(OpCode::generic); \
+                NUMERIC_OP(op, generic##_INT_QUICK, generic##_FLOAT_QUICK); \
+            } \
+        } while (false)
+
+    // Work that has to happen before every instruction is executed.
+    #define BEGIN_INSTRUCTION() \
+        do { \
+            if constexpr (isTracing) { \
+                STORE_STACK(); \
+                traceInstruction(frame); \
+            } \
+            if constexpr (isProfiling) { \
+                m_profiler->recordInstruction(frame->closure->getFunction(), \
+                        frame->ip - frame->closure->getFunction()->getChunk().getCode().data()); \
+            } \
+        } while (false)
+
+#ifdef ENACT_COMPUTED_GOTO_ENABLED
+    // Threaded dispatch: every handler jumps straight to the handler of the next instruction.
+    // This table must list the labels in the same order as the OpCode enum.
+    static void* dispatchTable[] = {
+            &&op_CONSTANT,
+            &&op_CONSTANT_LONG,
+            &&op_TRUE,
+            &&op_FALSE,
+            &&op_NIL,
+            &&op_CHECK_INT,
+            &&op_CHECK_NUMERIC,
+            &&op_CHECK_STRING,
+            &&op_CHECK_BOOL,
+            &&op_CHECK_REFERENCE,
+            &&op_CHECK_CALLABLE,
+            &&op_CHECK_INDEXABLE,
+            &&op_CHECK_ALLOTABLE,
+            &&op_CHECK_TYPE,
+            &&op_CHECK_TYPE_LONG,
+            &&op_NEGATE,
+            &&op_NOT,
+            &&op_COPY,
+            &&op_ADD,
+            &&op_SUBTRACT,
+            &&op_MULTIPLY,
+            &&op_DIVIDE,
+            &&op_LESS,
+            &&op_GREATER,
+            &&op_EQUAL,
+            &&op_CONCATENATE,
+            &&op_ADD_INT,
+            &&op_SUBTRACT_INT,
+            &&op_MULTIPLY_INT,
+            &&op_DIVIDE_INT,
+            &&op_LESS_INT,
+            &&op_GREATER_INT,
+            &&op_LESS_EQUAL_INT,
+            &&op_GREATER_EQUAL_INT,
+            &&op_ADD_FLOAT,
+            &&op_SUBTRACT_FLOAT,
+            &&op_MULTIPLY_FLOAT,
+            &&op_DIVIDE_FLOAT,
+            &&op_LESS_FLOAT,
+            &&op_GREATER_FLOAT,
+            &&op_ADD_INT_QUICK,
+            &&op_SUBTRACT_INT_QUICK,
+            &&op_MULTIPLY_INT_QUICK,
+            &&op_DIVIDE_INT_QUICK,
+            &&op_LESS_INT_QUICK,
+            &&op_GREATER_INT_QUICK,
+            &&op_ADD_FLOAT_QUICK,
+            &&op_SUBTRACT_FLOAT_QUICK,
+            &&op_MULTIPLY_FLOAT_QUICK,
+            &&op_DIVIDE_FLOAT_QUICK,
+            &&op_LESS_FLOAT_QUICK,
+            &&op_GREATER_FLOAT_QUICK,
+            &&op_ADD_LOCAL_CONSTANT,
+            &&op_SUBTRACT_LOCAL_CONSTANT,
+            &&op_INC_LOCAL,
+            &&op_LESS_LOCAL_CONSTANT_JUMP_IF_FALSE,
+            &&op_ARRAY,
+            &&op_ARRAY_LONG,
+            &&op_GET_ARRAY_INDEX,
+            &&op_SET_ARRAY_INDEX,
+            &&op_POP,
+            &&op_GET_LOCAL,
+            &&op_GET_LOCAL_LONG,
+            &&op_SET_LOCAL,
+            &&op_SET_LOCAL_LONG,
+            &&op_GET_UPVALUE,
+            &&op_GET_UPVALUE_LONG,
+            &&op_SET_UPVALUE,
+            &&op_SET_UPVALUE_LONG,
+            &&op_JUMP,
+            &&op_JUMP_IF_TRUE,
+            &&op_JUMP_IF_FALSE,
+            &&op_LOOP,
+            &&op_CALL,
+            &&op_CLOSURE,
+            &&op_CLOSURE_LONG,
+            &&op_CLOSE_UPVALUE,
+            &&op_RETURN,
+    };
+
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OPCODE_COUNT,
+            "VM::run: dispatchTable must have an entry for every OpCode.");
+
+    #define INTERPRET_LOOP DISPATCH();
+    #define CASE(name) op_##name
+    #define DISPATCH() \
+        do { \
+            BEGIN_INSTRUCTION(); \
+            goto *dispatchTable[READ_BYTE()]; \
+        } while (false)
+#else
+    #define INTERPRET_LOOP \
+        loop: \
+            BEGIN_INSTRUCTION(); \
+            switch (static_cast<OpCode>(READ_BYTE()))
+    #define CASE(name) case OpCode::name
+    #define DISPATCH() goto loop
+#endif
+
+    INTERPRET_LOOP {
+        CASE(CONSTANT): {
+            Value constant = READ_CONSTANT();
+            PUSH(constant);
+            DISPATCH();
+        }
 
-            case OpCode::CHECK_INT: {
-                Value value = peek(0);
-                if (!value.getType()->isInt()) {
-                    runtimeError("Expected a value of type 'int', but got a value of type '"
-                                 + value.getType()->toString() + "' instead.");
+        CASE(CONSTANT_LONG): {
+            Value constant = READ_CONSTANT_LONG();
+            PUSH(constant);
+            DISPATCH();
+        }
 
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+        CASE(TRUE): PUSH(Value{true}); DISPATCH();
+        CASE(FALSE): PUSH(Value{false}); DISPATCH();
+        CASE(NIL): PUSH(Value{}); DISPATCH();
+
+        CASE(CHECK_INT): {
+            Value value = PEEK(0);
+            if (!value.getType()->isInt()) {
+                runtimeError("Expected a value of type 'int', but got a value of type '"
+                             + value.getType()->toString() + "' instead.");
+
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_NUMERIC: {
-                Value value = peek(0);
-                if (!value.getType()->isNumeric()) {
-                    runtimeError("Expected a value of type 'int' or 'float', but got a value of type '"
-                            + value.getType()->toString() + "' instead.");
+            DISPATCH();
+        }
+        CASE(CHECK_NUMERIC): {
+            Value value = PEEK(0);
+            if (!value.getType()->isNumeric()) {
+                runtimeError("Expected a value of type 'int' or 'float', but got a value of type '"
+                        + value.getType()->toString() + "' instead.");
 
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_BOOL: {
-                Value value = peek(0);
-                if (!value.getType()->isBool()) {
-                    runtimeError("Expected a value of type 'bool', but got a value of type '"
-                            + value.getType()->toString() + "' instead.");
+            DISPATCH();
+        }
+        CASE(CHECK_STRING): {
+            Value value = PEEK(0);
+            if (!value.getType()->isString()) {
+                runtimeError("Expected a value of type 'string', but got a value of type '"
+                        + value.getType()->toString() + "' instead.");
 
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_REFERENCE: {
-                Value value = peek(0);
-                if (value.getType()->isPrimitive()) {
-                    runtimeError("Only reference types can be copied, not a value of type '"
-                                 + value.getType()->toString() + "'.");
+            DISPATCH();
+        }
+        CASE(CHECK_BOOL): {
+            Value value = PEEK(0);
+            if (!value.getType()->isBool()) {
+                runtimeError("Expected a value of type 'bool', but got a value of type '"
+                        + value.getType()->toString() + "' instead.");
 
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_CALLABLE: {
-                uint8_t argCount = READ_BYTE();
+            DISPATCH();
+        }
+        CASE(CHECK_REFERENCE): {
+            Value value = PEEK(0);
+            if (value.getType()->isPrimitive()) {
+                runtimeError("Only reference types can be copied, not a value of type '"
+                             + value.getType()->toString() + "'.");
 
-                Value functionValue = peek(argCount);
-                if (!functionValue.getType()->isFunction()) {
-                    runtimeError("Only functions can be called, not a value of type '"
-                            + functionValue.getType()->toString() + ".");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+                return InterpretResult::RUNTIME_ERROR;
+            }
+            DISPATCH();
+        }
+        CASE(CHECK_CALLABLE): {
+            uint8_t argCount = READ_BYTE();
+
+            Value functionValue = PEEK(argCount);
+            if (!functionValue.getType()->isFunction()) {
+                runtimeError("Only functions can be called, not a value of type '"
+                        + functionValue.getType()->toString() + ".");
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                const FunctionType* functionType = functionValue.getType()->as<FunctionType>();
+            const FunctionType* functionType = functionValue.getType()->as<FunctionType>();
 
-                uint8_t paramCount = functionType->getArgumentTypes().size();
-                if (argCount != paramCount) {
+            uint8_t paramCount = functionType->getArgumentTypes().size();
+            if (argCount != paramCount) {
+                std::stringstream s;
+                s << "Expected " << static_cast<size_t>(paramCount) << " arguments to function, but got " <<
+                        static_cast<size_t>(argCount) << ".";
+                runtimeError(s.str());
+                return InterpretResult::RUNTIME_ERROR;
+            }
+
+            for (uint8_t i = 0; i < argCount; ++i) {
+                Type shouldBe = functionType->getArgumentTypes()[i];
+                Type argumentType = PEEK(i).getType();
+                if (!argumentType->looselyEquals(*shouldBe)) {
                     std::stringstream s;
-                    s << "Expected " << static_cast<size_t>(paramCount) << " arguments to function, but got " <<
-                            static_cast<size_t>(argCount) << ".";
+                    s << "Expected argument " << static_cast<size_t>(i) + 1 << " to be of type '" <<
+                        shouldBe->toString() << "' but got value of type '" + argumentType->toString() <<
+                        "' instead.";
                     runtimeError(s.str());
                     return InterpretResult::RUNTIME_ERROR;
                 }
-
-                for (uint8_t i = 0; i < argCount; ++i) {
-                    Type shouldBe = functionType->getArgumentTypes()[i];
-                    Type argumentType = peek(i).getType();
-                    if (!argumentType->looselyEquals(*shouldBe)) {
-                        std::stringstream s;
-                        s << "Expected argument " << static_cast<size_t>(i) + 1 << " to be of type '" <<
-                            shouldBe->toString() << "' but got value of type '" + argumentType->toString() <<
-                            "' instead.";
-                        runtimeError(s.str());
-                        return InterpretResult::RUNTIME_ERROR;
-                    }
-                }
-                break;
             }
-            case OpCode::CHECK_INDEXABLE: {
-                Value array = peek(0);
-                if (!array.getType()->isArray()) {
-                    runtimeError("Expected an array, but got a value of type '" + array.getType()->toString() +
-                            "' instead.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+            DISPATCH();
+        }
+        CASE(CHECK_INDEXABLE): {
+            Value array = PEEK(0);
+            if (!array.getType()->isArray()) {
+                runtimeError("Expected an array, but got a value of type '" + array.getType()->toString() +
+                        "' instead.");
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_ALLOTABLE: {
-                Type shouldBe = peek(0).getType()->as<ArrayType>()->getElementType();
-                Type valueType = peek(1).getType();
+            DISPATCH();
+        }
+        CASE(CHECK_ALLOTABLE): {
+            Type shouldBe = PEEK(0).getType()->as<ArrayType>()->getElementType();
+            Type valueType = PEEK(1).getType();
 
-                if (!valueType->looselyEquals(*shouldBe)) {
-                    runtimeError("Expected a value of type '" + shouldBe->toString() +
-                        "' to assign in array, but got a value of type '" + valueType->toString() + "' instead.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+            if (!valueType->looselyEquals(*shouldBe)) {
+                allotError(*PEEK(0).asObject()->as<ArrayObject>(), PEEK(1));
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_TYPE: {
-                Type shouldBe = READ_CONSTANT().asObject()->getType();
-                Value value = peek(0);
-                if (!shouldBe->looselyEquals(*value.getType())) {
-                    runtimeError("Expected a value of type '" + shouldBe->toString() +
-                            "' but got a value of type '" + value.getType()->toString() + "' instead.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+            DISPATCH();
+        }
+        CASE(CHECK_TYPE): {
+            Type shouldBe = READ_CONSTANT().asObject()->getType();
+            Value value = PEEK(0);
+            if (!shouldBe->looselyEquals(*value.getType())) {
+                runtimeError("Expected a value of type '" + shouldBe->toString() +
+                        "' but got a value of type '" + value.getType()->toString() + "' instead.");
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::CHECK_TYPE_LONG: {
-                Type shouldBe = READ_CONSTANT_LONG().asObject()->getType();
-                Value value = peek(0);
-                if (!shouldBe->looselyEquals(*value.getType())) {
-                    runtimeError("Expected a value of type '" + shouldBe->toString() +
-                                 "' but got a value of type '" + value.getType()->toString() + "' instead.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
-                break;
+            DISPATCH();
+        }
+        CASE(CHECK_TYPE_LONG): {
+            Type shouldBe = READ_CONSTANT_LONG().asObject()->getType();
+            Value value = PEEK(0);
+            if (!shouldBe->looselyEquals(*value.getType())) {
+                runtimeError("Expected a value of type '" + shouldBe->toString() +
+                             "' but got a value of type '" + value.getType()->toString() + "' instead.");
+                return InterpretResult::RUNTIME_ERROR;
             }
+            DISPATCH();
+        }
 
-            case OpCode::NEGATE: {
-                Value value = pop();
-                if (value.isInt()) {
-                    push(Value{-value.asInt()});
-                } else {
-                    push(Value{-value.asDouble()});
-                }
-                break;
+        CASE(NEGATE): {
+            Value value = POP();
+            if (value.isInt()) {
+                PUSH(Value{-value.asInt()});
+            } else {
+                PUSH(Value{-value.asDouble()});
+            }
+            DISPATCH();
+        }
+        CASE(NOT): PEEK(0) = Value{!PEEK(0).asBool()}; DISPATCH();
+
+        CASE(COPY): {
+            // Copies are allocated old, so they may point into the nursery.
+            Object* copy = PEEK(0).asObject()->clone(m_heap);
+            m_heap.remember(copy);
+            PEEK(0) = Value{copy};
+            DISPATCH();
+        }
+
+        CASE(ADD): ADD_OP(); DISPATCH();
+        CASE(SUBTRACT): NUMERIC_OP(-, SUBTRACT_INT_QUICK, SUBTRACT_FLOAT_QUICK); DISPATCH();
+        CASE(MULTIPLY): NUMERIC_OP(*, MULTIPLY_INT_QUICK, MULTIPLY_FLOAT_QUICK); DISPATCH();
+        CASE(DIVIDE): NUMERIC_OP(/, DIVIDE_INT_QUICK, DIVIDE_FLOAT_QUICK); DISPATCH();
+
+        CASE(LESS): NUMERIC_OP(<, LESS_INT_QUICK, LESS_FLOAT_QUICK); DISPATCH();
+        CASE(GREATER): NUMERIC_OP(>, GREATER_INT_QUICK, GREATER_FLOAT_QUICK); DISPATCH();
+
+        CASE(ADD_INT): INT_OP(+); DISPATCH();
+        CASE(SUBTRACT_INT): INT_OP(-); DISPATCH();
+        CASE(MULTIPLY_INT): INT_OP(*); DISPATCH();
+        CASE(DIVIDE_INT): INT_OP(/); DISPATCH();
+        CASE(LESS_INT): INT_OP(<); DISPATCH();
+        CASE(GREATER_INT): INT_OP(>); DISPATCH();
+        CASE(LESS_EQUAL_INT): INT_OP(<=); DISPATCH();
+        CASE(GREATER_EQUAL_INT): INT_OP(>=); DISPATCH();
+
+        CASE(ADD_FLOAT): FLOAT_OP(+); DISPATCH();
+        CASE(SUBTRACT_FLOAT): FLOAT_OP(-); DISPATCH();
+        CASE(MULTIPLY_FLOAT): FLOAT_OP(*); DISPATCH();
+        CASE(DIVIDE_FLOAT): FLOAT_OP(/); DISPATCH();
+        CASE(LESS_FLOAT): FLOAT_OP(<); DISPATCH();
+        CASE(GREATER_FLOAT): FLOAT_OP(>); DISPATCH();
+
+        // ADD may also be given two strings, so its quickened forms fall back to ADD_OP.
+        CASE(ADD_INT_QUICK):
+            if (PEEK(0).isInt() && PEEK(1).isInt()) {
+                INT_OP(+);
+            } else {
+                QUICKEN(OpCode::ADD);
+                ADD_OP();
+            }
+            DISPATCH();
+        CASE(SUBTRACT_INT_QUICK): QUICK_OP(-, isInt, INT_OP, SUBTRACT); DISPATCH();
+        CASE(MULTIPLY_INT_QUICK): QUICK_OP(*, isInt, INT_OP, MULTIPLY); DISPATCH();
+        CASE(DIVIDE_INT_QUICK): QUICK_OP(/, isInt, INT_OP, DIVIDE); DISPATCH();
+        CASE(LESS_INT_QUICK): QUICK_OP(<, isInt, INT_OP, LESS); DISPATCH();
+        CASE(GREATER_INT_QUICK): QUICK_OP(>, isInt, INT_OP, GREATER); DISPATCH();
+
+        CASE(ADD_FLOAT_QUICK):
+            if (PEEK(0).isDouble() && PEEK(1).isDouble()) {
+                FLOAT_OP(+);
+            } else {
+                QUICKEN(OpCode::ADD);
+                ADD_OP();
+            }
+            DISPATCH();
+        CASE(SUBTRACT_FLOAT_QUICK): QUICK_OP(-, isDouble, FLOAT_OP, SUBTRACT); DISPATCH();
+        CASE(MULTIPLY_FLOAT_QUICK): QUICK_OP(*, isDouble, FLOAT_OP, MULTIPLY); DISPATCH();
+        CASE(DIVIDE_FLOAT_QUICK): QUICK_OP(/, isDouble, FLOAT_OP, DIVIDE); DISPATCH();
+        CASE(LESS_FLOAT_QUICK): QUICK_OP(<, isDouble, FLOAT_OP, LESS); DISPATCH();
+        CASE(GREATER_FLOAT_QUICK): QUICK_OP(>, isDouble, FLOAT_OP, GREATER); DISPATCH();
+
+        CASE(ADD_LOCAL_CONSTANT): {
+            int a = slots[READ_BYTE()].asInt();
+            int b = READ_CONSTANT().asInt();
+            PUSH(Value{a + b});
+            DISPATCH();
+        }
+        CASE(SUBTRACT_LOCAL_CONSTANT): {
+            int a = slots[READ_BYTE()].asInt();
+            int b = READ_CONSTANT().asInt();
+            PUSH(Value{a - b});
+            DISPATCH();
+        }
+        CASE(INC_LOCAL): {
+            Value& local = slots[READ_BYTE()];
+            local = Value{local.asInt() + 1};
+            DISPATCH();
+        }
+        CASE(LESS_LOCAL_CONSTANT_JUMP_IF_FALSE): {
+            int a = slots[READ_BYTE()].asInt();
+            int b = READ_CONSTANT().asInt();
+            uint16_t jumpSize = READ_SHORT();
+            if (!(a < b)) {
+                frame->ip += jumpSize;
             }
-            case OpCode::NOT: push(Value{!pop().asBool()}); break;
-
-            case OpCode::COPY: push(Value{pop().asObject()->clone()}); break;
-
-            case OpCode::ADD: NUMERIC_OP(+); break;
-            case OpCode::SUBTRACT: NUMERIC_OP(-); break;
-            case OpCode::MULTIPLY: NUMERIC_OP(*); break;
-            case OpCode::DIVIDE: NUMERIC_OP(/); break;
-
-            case OpCode::LESS: NUMERIC_OP(<); break;
-            case OpCode::GREATER: NUMERIC_OP(>); break;
-            case OpCode::EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(Value{a == b});
-                break;
+            DISPATCH();
+        }
+
+        CASE(EQUAL): {
+            // Comparing ropes flattens them, so that comparing them again is as cheap as comparing strings.
+            if (isRope(PEEK(0)) || isRope(PEEK(1))) {
+                STORE_STACK();
+                if (isRope(PEEK(0))) m_heap.flatten(PEEK(0));
+                if (isRope(PEEK(1))) m_heap.flatten(PEEK(1));
             }
 
+            Value b = POP();
+            Value a = POP();
+            PUSH(Value{a == b});
+            DISPATCH();
+        }
+        CASE(CONCATENATE): {
+            STORE_STACK();
+            Object* result = m_heap.concatenate(PEEK(1), PEEK(0));
+            DROP();
+            PEEK(0) = Value{result};
+            DISPATCH();
+        }
+
 
-            case OpCode::ARRAY: {
-                uint8_t length = READ_BYTE();
-                Type type = READ_CONSTANT().asObject()->as<TypeObject>()->getContainedType();
-                auto* array = GC::allocateObject<ArrayObject>(length, type);
-                if (length != 0) {
-                    for (uint8_t i = length; i-- > 0;) {
-                        array->at(i) = pop();
+        CASE(ARRAY): {
+            uint8_t length = READ_BYTE();
+            Type type = READ_CONSTANT().asObject()->as<TypeObject>()->getContainedType();
+            STORE_STACK();
+            auto* array = m_heap.allocateObject<ArrayObject>(length, type);
+            if (length != 0) {
+                for (uint8_t i = length; i-- > 0;) {
+                    Value value = POP();
+                    if (!array->canHold(value)) {
+                        allotError(*array, value);
+                        return InterpretResult::RUNTIME_ERROR;
                     }
+                    array->set(i, value);
                 }
-                push(Value{array});
-                break;
             }
-            case OpCode::ARRAY_LONG: {
-                uint32_t length = READ_LONG();
-                Type type = READ_CONSTANT_LONG().asObject()->as<TypeObject>()->getContainedType();
-                auto* array = GC::allocateObject<ArrayObject>(length, type);
-                if (length != 0) {
-                    for (uint32_t i = length; i-- > 0;) {
-                        array->at(i) = pop();
+            PUSH(Value{array});
+            DISPATCH();
+        }
+        CASE(ARRAY_LONG): {
+            uint32_t length = READ_LONG();
+            Type type = READ_CONSTANT_LONG().asObject()->as<TypeObject>()->getContainedType();
+            STORE_STACK();
+            auto* array = m_heap.allocateObject<ArrayObject>(length, type);
+            if (length != 0) {
+                for (uint32_t i = length; i-- > 0;) {
+                    Value value = POP();
+                    if (!array->canHold(value)) {
+                        allotError(*array, value);
+                        return InterpretResult::RUNTIME_ERROR;
                     }
+                    array->set(i, value);
                 }
-                push(Value{array});
-                break;
             }
+            PUSH(Value{array});
+            DISPATCH();
+        }
 
-            case OpCode::GET_ARRAY_INDEX: {
-                int index = pop().asInt();
-                ArrayObject* array = pop().asObject()->as<ArrayObject>();
+        CASE(GET_ARRAY_INDEX): {
+            int index = POP().asInt();
+            ArrayObject* array = POP().asObject()->as<ArrayObject>();
 
-                if (index >= array->length()) {
-                    runtimeError("Array index '" + std::to_string(index) + "' is out of bounds for array of "
-                             + "length '" + std::to_string(array->asVector().size()) + "'.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
+            if (index < 0 || static_cast<size_t>(index) >= array->length()) {
+                runtimeError("Array index '" + std::to_string(index) + "' is out of bounds for array of "
+                         + "length '" + std::to_string(array->length()) + "'.");
+                return InterpretResult::RUNTIME_ERROR;
+            }
 
-                push(array->at(index));
-                break;
+            PUSH(array->get(index));
+            DISPATCH();
+        }
+        CASE(SET_ARRAY_INDEX): {
+            int index = POP().asInt();
+            ArrayObject* array = POP().asObject()->as<ArrayObject>();
+            Value newValue = PEEK(0);
+
+            if (index < 0 || static_cast<size_t>(index) >= array->length()) {
+                runtimeError("Array index '" + std::to_string(index) + "' is out of bounds for array of "
+                             + "length '" + std::to_string(array->length()) + "'.");
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::SET_ARRAY_INDEX: {
-                int index = pop().asInt();
-                ArrayObject* array = pop().asObject()->as<ArrayObject>();
-                Value newValue = peek(0);
-
-                if (index >= array->length()) {
-                    runtimeError("Array index '" + std::to_string(index) + "' is out of bounds for array of "
-                                 + "length '" + std::to_string(array->asVector().size()) + "'.");
-                    return InterpretResult::RUNTIME_ERROR;
-                }
 
-                array->at(index) = newValue;
-                break;
+            if (!array->canHold(newValue)) {
+                allotError(*array, newValue);
+                return InterpretResult::RUNTIME_ERROR;
             }
 
-            case OpCode::POP: pop(); break;
+            array->set(index, newValue);
+            m_heap.writeBarrier(array, newValue);
+            DISPATCH();
+        }
 
-            case OpCode::GET_LOCAL: push(slots[READ_BYTE()]); break;
-            case OpCode::GET_LOCAL_LONG: push(slots[READ_LONG()]); break;
+        CASE(POP): DROP(); DISPATCH();
 
-            case OpCode::SET_LOCAL: slots[READ_BYTE()] = peek(0); break;
-            case OpCode::SET_LOCAL_LONG: slots[READ_LONG()] = peek(0); break;
+        CASE(GET_LOCAL): PUSH(slots[READ_BYTE()]); DISPATCH();
+        CASE(GET_LOCAL_LONG): PUSH(slots[READ_LONG()]); DISPATCH();
 
-            case OpCode::GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                UpvalueObject* upvalue = frame->closure->getUpvalues()[slot];
-                push(upvalue->isClosed() ?
-                        upvalue->getClosed() :
-                        m_stack[upvalue->getLocation()]);
-                break;
-            }
-            case OpCode::GET_UPVALUE_LONG: {
-                uint8_t slot = READ_BYTE();
-                UpvalueObject* upvalue = frame->closure->getUpvalues()[slot];
-                push(upvalue->isClosed() ?
-                      upvalue->getClosed() :
-                      m_stack[upvalue->getLocation()]);
-                break;
-            }
+        CASE(SET_LOCAL): slots[READ_BYTE()] = PEEK(0); DISPATCH();
+        CASE(SET_LOCAL_LONG): slots[READ_LONG()] = PEEK(0); DISPATCH();
 
-            case OpCode::SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                m_stack[frame->closure->getUpvalues()[slot]->getLocation()] = peek(0);
-                break;
-            }
-            case OpCode::SET_UPVALUE_LONG: {
-                uint32_t slot = READ_LONG();
-                m_stack[frame->closure->getUpvalues()[slot]->getLocation()] = peek(0);
-                break;
-            }
+        CASE(GET_UPVALUE): {
+            uint8_t slot = READ_BYTE();
+            UpvalueObject* upvalue = frame->closure->getUpvalues()[slot];
+            PUSH(upvalue->isClosed() ?
+                    upvalue->getClosed() :
+                    m_stack[upvalue->getLocation()]);
+            DISPATCH();
+        }
+        CASE(GET_UPVALUE_LONG): {
+            uint8_t slot = READ_BYTE();
+            UpvalueObject* upvalue = frame->closure->getUpvalues()[slot];
+            PUSH(upvalue->isClosed() ?
+                  upvalue->getClosed() :
+                  m_stack[upvalue->getLocation()]);
+            DISPATCH();
+        }
 
-            case OpCode::JUMP: {
-                uint16_t jumpSize = READ_SHORT();
+        CASE(SET_UPVALUE): {
+            uint8_t slot = READ_BYTE();
+            m_stack[frame->closure->getUpvalues()[slot]->getLocation()] = PEEK(0);
+            DISPATCH();
+        }
+        CASE(SET_UPVALUE_LONG): {
+            uint32_t slot = READ_LONG();
+            m_stack[frame->closure->getUpvalues()[slot]->getLocation()] = PEEK(0);
+            DISPATCH();
+        }
+
+        CASE(JUMP): {
+            uint16_t jumpSize = READ_SHORT();
+            frame->ip += jumpSize;
+            DISPATCH();
+        }
+        CASE(JUMP_IF_TRUE): {
+            uint16_t jumpSize = READ_SHORT();
+            if (PEEK(0).asBool()) {
                 frame->ip += jumpSize;
-                break;
             }
-            case OpCode::JUMP_IF_TRUE: {
-                uint16_t jumpSize = READ_SHORT();
-                if (peek(0).asBool()) {
-                    frame->ip += jumpSize;
-                }
-                break;
+            DISPATCH();
+        }
+        CASE(JUMP_IF_FALSE): {
+            uint16_t jumpSize = READ_SHORT();
+            if (!PEEK(0).asBool()) {
+                frame->ip += jumpSize;
             }
-            case OpCode::JUMP_IF_FALSE: {
-                uint16_t jumpSize = READ_SHORT();
-                if (!peek(0).asBool()) {
-                    frame->ip += jumpSize;
+            DISPATCH();
+        }
+
+        CASE(LOOP): {
+            uint16_t jumpSize = READ_SHORT();
+            frame->ip -= jumpSize;
+            DISPATCH();
+        }
+
+        CASE(CALL): {
+            uint8_t argCount = READ_BYTE();
+            Object* callee = PEEK(argCount).asObject();
+
+            STORE_STACK();
+            if (callee->is<ClosureObject>()) {
+                if (!call(callee->as<ClosureObject>())) {
+                    return InterpretResult::RUNTIME_ERROR;
                 }
-                break;
-            }
+                frame = &m_frames[m_frameCount - 1];
+                slots = &m_stack[frame->slotsBegin];
+            } else {
+                NativeFn native = callee->as<NativeObject>()->getFunction();
+                Value result = native(*this, argCount, stackTop - argCount);
 
-            case OpCode::LOOP: {
-                uint16_t jumpSize = READ_SHORT();
-                frame->ip -= jumpSize;
-                break;
+                stackTop -= argCount + 1;
+                PUSH(result);
             }
+            DISPATCH();
+        }
 
-            case OpCode::CALL: {
-                uint8_t argCount = READ_BYTE();
-                Object* callee = peek(argCount).asObject();
-
-                if (callee->is<ClosureObject>()) {
-                    call(callee->as<ClosureObject>());
-                    frame = &m_frames[m_frameCount - 1];
+        CASE(CLOSURE): {
+            FunctionObject* function = READ_CONSTANT().asObject()->as<FunctionObject>();
+            PUSH(Value{function});
+            STORE_STACK();
+            PEEK(0) = Value{m_heap.allocateObject<ClosureObject>(function)};
+
+            for (size_t i = 0; i < function->getUpvalueCount(); ++i) {
+                uint8_t isLocal = READ_BYTE();
+                uint32_t index;
+                if (i < UINT8_MAX) {
+                    index = READ_BYTE();
                 } else {
-                    NativeFn native = callee->as<NativeObject>()->getFunction();
-                    Value result = native(argCount, &m_stack.back() - argCount + 1);
+                    index = READ_LONG();
+                }
 
-                    m_stack.erase(m_stack.end() - argCount - 1, m_stack.end());
+                UpvalueObject* upvalue = isLocal ?
+                        captureUpvalue(frame->slotsBegin + index) :
+                        frame->closure->getUpvalues()[i];
 
-                    push(result);
-                }
-                break;
+                // Capturing may have promoted the closure, so it is only ever read from the stack.
+                auto* closure = PEEK(0).asObject()->as<ClosureObject>();
+                closure->getUpvalues()[i] = upvalue;
+                m_heap.writeBarrier(closure, upvalue);
             }
+            DISPATCH();
+        }
 
-            case OpCode::CLOSURE: {
-                FunctionObject* function = READ_CONSTANT().asObject()->as<FunctionObject>();
-                push(Value{function});
-                ClosureObject* closure = GC::allocateObject<ClosureObject>(function);
-                pop();
-                push(Value{closure});
-
-                for (size_t i = 0; i < closure->getUpvalues().size(); ++i) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint32_t index;
-                    if (i < UINT8_MAX) {
-                        index = READ_BYTE();
-                    } else {
-                        index = READ_LONG();
-                    }
-
-                    if (isLocal) {
-                        closure->getUpvalues()[i] = captureUpvalue(frame->slotsBegin + index);
-                    } else {
-                        closure->getUpvalues()[i] = frame->closure->getUpvalues()[i];
-                    }
+        CASE(CLOSURE_LONG): {
+            FunctionObject* function = READ_CONSTANT_LONG().asObject()->as<FunctionObject>();
+            PUSH(Value{function});
+            STORE_STACK();
+            PEEK(0) = Value{m_heap.allocateObject<ClosureObject>(function)};
+
+            for (size_t i = 0; i < function->getUpvalueCount(); ++i) {
+                uint8_t isLocal = READ_BYTE();
+                uint32_t index;
+                if (i < UINT8_MAX) {
+                    index = READ_BYTE();
+                } else {
+                    index = READ_LONG();
                 }
-                break;
-            }
 
-            case OpCode::CLOSURE_LONG: {
-                FunctionObject* function = READ_CONSTANT_LONG().asObject()->as<FunctionObject>();
-                push(Value{function});
-                ClosureObject* closure = GC::allocateObject<ClosureObject>(function);
-                pop();
-                push(Value{closure});
-
-                for (size_t i = 0; i < closure->getUpvalues().size(); ++i) {
-                    uint8_t isLocal = READ_BYTE();
-                    uint32_t index;
-                    if (i < UINT8_MAX) {
-                        index = READ_BYTE();
-                    } else {
-                        index = READ_LONG();
-                    }
+                UpvalueObject* upvalue = isLocal ?
+                        captureUpvalue(frame->slotsBegin + index) :
+                        frame->closure->getUpvalues()[i];
 
-                    if (isLocal) {
-                        closure->getUpvalues()[i] = captureUpvalue(frame->slotsBegin + index);
-                    } else {
-                        closure->getUpvalues()[i] = frame->closure->getUpvalues()[i];
-                    }
-                }
-                break;
+                // Capturing may have promoted the closure, so it is only ever read from the stack.
+                auto* closure = PEEK(0).asObject()->as<ClosureObject>();
+                closure->getUpvalues()[i] = upvalue;
+                m_heap.writeBarrier(closure, upvalue);
             }
+            DISPATCH();
+        }
 
-            case OpCode::CLOSE_UPVALUE:
-                closeUpvalues(m_stack.size() - 1);
-                pop();
-                break;
+        CASE(CLOSE_UPVALUE):
+            closeUpvalues(static_cast<uint32_t>(stackTop - 1 - m_stack.get()));
+            DROP();
+            DISPATCH();
 
-            case OpCode::RETURN: {
-                Value result = pop();
+        CASE(RETURN): {
+            Value result = POP();
 
-                closeUpvalues(frame->slotsBegin);
+            closeUpvalues(frame->slotsBegin);
 
-                m_frameCount--;
-                if (m_frameCount == 0) {
-                    pop();
-                    return InterpretResult::OK;
-                }
+            m_frameCount--;
+            if (m_frameCount == 0) {
+                DROP();
+                STORE_STACK();
+                return InterpretResult::OK;
+            }
 
-                m_stack.erase(m_stack.begin() + frame->slotsBegin, m_stack.end());
-                push(result);
+            // Discard the callee, its arguments and its locals all at once.
+            stackTop = slots;
+            PUSH(result);
 
-                frame = &m_frames[m_frameCount - 1];
-                break;
-            }
+            frame = &m_frames[m_frameCount - 1];
+            slots = &m_stack[frame->slotsBegin];
+            DISPATCH();
         }
+    }
 
-        #undef READ_BYTE
-        #undef READ_SHORT
-        #undef READ_LONG
-        #undef READ_CONSTANT
-        #undef READ_CONSTANT_LONG
+    ENACT_ABORT("Unreachable: unknown opcode in VM::run.");
+
+    #undef READ_BYTE
+    #undef READ_SHORT
+    #undef READ_LONG
+    #undef READ_CONSTANT
+    #undef READ_CONSTANT_LONG
+
+    #undef PUSH
+    #undef POP
+    #undef DROP
+    #undef PEEK
+    #undef STORE_STACK
+    #undef LOAD_STACK
+    #undef QUICKEN
+    #undef NUMERIC_OP
+    #undef INT_OP
+    #undef FLOAT_OP
+    #undef QUICK_OP
+    #undef ADD_OP
+
+    #undef BEGIN_INSTRUCTION
+    #undef INTERPRET_LOOP
+    #undef CASE
+    #undef DISPATCH
+}
 
-        #undef NUMERIC_OP
+void VM::traceInstruction(CallFrame* frame) {
+    std::cout << "    ";
+    for (Value* slot = m_stack.get(); slot < m_stackTop; ++slot) {
+        std::cout << "[ " << *slot << " ] ";
     }
+    std::cout << "\n";
+
+    std::cout << frame->closure->getFunction()->getChunk()
+            .disassembleInstruction(
+                    frame->ip - frame->closure->getFunction()->getChunk().getCode().data()).first;
 }
 
 void VM::push(Value value) {
-    m_stack.push_back(value);
+    ENACT_ASSERT(m_stackTop < m_stack.get() + STACK_MAX, "Stack overflow!");
+    *m_stackTop++ = value;
 }
 
 Value VM::pop() {
-    ENACT_ASSERT(!m_stack.empty(), "Stack underflow!");
-    Value value = m_stack.back();
-    m_stack.pop_back();
-    return value;
+    ENACT_ASSERT(m_stackTop > m_stack.get(), "Stack underflow!");
+    return *--m_stackTop;
 }
 
 Value VM::peek(size_t depth) {
-    return m_stack[m_stack.size() - 1 - depth];
+    return m_stackTop[-1 - static_cast<ptrdiff_t>(depth)];
 }
 
-void VM::call(ClosureObject* closure) {
-    if (m_frameCount == FRAMES_MAX) {
+bool VM::call(ClosureObject* closure) {
+    const Chunk& chunk = closure->getFunction()->getChunk();
+
+    // This is the only overflow check: the compiler has worked out how deep the function's stack can get.
+    if (m_frameCount == FRAMES_MAX || m_stackTop + chunk.getMaxStackDepth() > m_stack.get() + STACK_MAX) {
         runtimeError("Stack overflow.");
+        return false;
     }
 
-    CallFrame* frame = &m_frames[m_frameCount++];
+    CallFrame* frame = &m_frames[m_frameCount];
     frame->closure = closure;
-    frame->ip = closure->getFunction()->getChunk().getCode().data();
+    frame->ip = chunk.getCode().data();
 
     uint8_t paramCount = closure->getFunction()->getType()->as<FunctionType>()->getArgumentTypes().size();
-    frame->slotsBegin = m_stack.size() - paramCount - 1;
+    frame->slotsBegin = m_stackTop - m_stack.get() - paramCount - 1;
+
+    // The Sampler's signal handler may look at the frames at any point, so only count the frame once it is filled in.
+    std::atomic_signal_fence(std::memory_order_release);
+    ++m_frameCount;
+
+    return true;
 }
 
 UpvalueObject* VM::captureUpvalue(uint32_t location) {
@@ -469,13 +858,23 @@ UpvalueObject* VM::captureUpvalue(uint32_t location) {
 
     if (upvalue != nullptr && upvalue->getLocation() == location) return upvalue;
 
-    auto* createdUpvalue = GC::allocateObject<UpvalueObject>(location);
+    auto* createdUpvalue = m_heap.allocateObject<UpvalueObject>(location);
+
+    // The allocation may have moved the upvalues we looked at, so find our place in the list again.
+    prevUpvalue = nullptr;
+    upvalue = m_openUpvalues;
+    while (upvalue != nullptr && upvalue->getLocation() == location) {
+        prevUpvalue = upvalue;
+        upvalue = upvalue->getNext();
+    }
+
     createdUpvalue->setNext(upvalue);
 
     if (prevUpvalue == nullptr) {
         m_openUpvalues = createdUpvalue;
     } else {
         prevUpvalue->setNext(createdUpvalue);
+        m_heap.writeBarrier(prevUpvalue, createdUpvalue);
     }
 
     return createdUpvalue;
@@ -485,11 +884,24 @@ void VM::closeUpvalues(uint32_t last) {
     while (m_openUpvalues != nullptr && m_openUpvalues->getLocation() >= last) {
         UpvalueObject* upvalue = m_openUpvalues;
         upvalue->setClosed(m_stack[upvalue->getLocation()]);
+        m_heap.writeBarrier(upvalue, upvalue->getClosed());
         m_openUpvalues = upvalue->getNext();
     }
 }
 
+void VM::allotError(const ArrayObject& array, const Value& value) {
+    Type shouldBe = array.getType()->as<ArrayType>()->getElementType();
+    runtimeError("Expected a value of type '" + shouldBe->toString() +
+            "' to assign in array, but got a value of type '" + value.getType()->toString() + "' instead.");
+}
+
 void VM::runtimeError(const std::string& msg) {
+    if (m_frameCount == 0) {
+        // We failed before the script itself started running.
+        std::cerr << msg << "\n";
+        return;
+    }
+
     CallFrame* frame = &m_frames[m_frameCount - 1];
     size_t instruction = frame->ip - frame->closure->getFunction()->getChunk().getCode().data();
     line_t line = frame->closure->getFunction()->getChunk().getLine(instruction);
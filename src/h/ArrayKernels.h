@@ -0,0 +1,42 @@
+#ifndef ENACT_ARRAYKERNELS_H
+#define ENACT_ARRAYKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Loops over the unboxed elements of arrays, for the array natives. They use the widest vector instructions that
+// the CPU turns out to support when the program starts, or plain loops where there are none.
+//
+// Results are the same whichever instructions are picked: ints wrap around like they do in bytecode, and floats
+// are always added up in the same order.
+namespace ArrayKernels {
+    int32_t sum(const int32_t* data, size_t length);
+    double sum(const double* data, size_t length);
+
+    // The data must not be empty. Floats have a NaN minimum and maximum if any of them is NaN.
+    int32_t min(const int32_t* data, size_t length);
+    double min(const double* data, size_t length);
+    int32_t max(const int32_t* data, size_t length);
+    double max(const double* data, size_t length);
+
+    int32_t dot(const int32_t* left, const int32_t* right, size_t length);
+    double dot(const double* left, const double* right, size_t length);
+
+    // Elementwise. The result may be the same as either operand.
+    void add(const int32_t* left, const int32_t* right, int32_t* result, size_t length);
+    void add(const double* left, const double* right, double* result, size_t length);
+    void multiply(const int32_t* left, const int32_t* right, int32_t* result, size_t length);
+    void multiply(const double* left, const double* right, double* result, size_t length);
+
+    // Returns length if the value isn't there. NaN is never found.
+    size_t indexOf(const int32_t* data, size_t length, int32_t value);
+    size_t indexOf(const double* data, size_t length, double value);
+    size_t count(const int32_t* data, size_t length, int32_t value);
+    size_t count(const double* data, size_t length, double value);
+
+    // The same, for bools packed into words a bit at a time. The bits past length must be zero.
+    size_t indexOf(const uint64_t* words, size_t length, bool value);
+    size_t count(const uint64_t* words, size_t length, bool value);
+}
+
+#endif //ENACT_ARRAYKERNELS_H
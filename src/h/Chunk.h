@@ -15,6 +15,7 @@ enum class OpCode : uint8_t {
 
     CHECK_INT,
     CHECK_NUMERIC,
+    CHECK_STRING,
     CHECK_BOOL,
     CHECK_REFERENCE,
     CHECK_CALLABLE,
@@ -36,6 +37,48 @@ enum class OpCode : uint8_t {
     GREATER,
     EQUAL,
 
+    // Concatenates two strings, which may be ropes.
+    CONCATENATE,
+
+    // Arithmetic on operands the analyser has proven to be ints or floats.
+    ADD_INT,
+    SUBTRACT_INT,
+    MULTIPLY_INT,
+    DIVIDE_INT,
+    LESS_INT,
+    GREATER_INT,
+    LESS_EQUAL_INT,
+    GREATER_EQUAL_INT,
+
+    ADD_FLOAT,
+    SUBTRACT_FLOAT,
+    MULTIPLY_FLOAT,
+    DIVIDE_FLOAT,
+    LESS_FLOAT,
+    GREATER_FLOAT,
+
+    // Specialized forms the VM rewrites generic arithmetic to once it has seen the operand types.
+    // They check their operands and rewrite themselves back if the types change.
+    ADD_INT_QUICK,
+    SUBTRACT_INT_QUICK,
+    MULTIPLY_INT_QUICK,
+    DIVIDE_INT_QUICK,
+    LESS_INT_QUICK,
+    GREATER_INT_QUICK,
+
+    ADD_FLOAT_QUICK,
+    SUBTRACT_FLOAT_QUICK,
+    MULTIPLY_FLOAT_QUICK,
+    DIVIDE_FLOAT_QUICK,
+    LESS_FLOAT_QUICK,
+    GREATER_FLOAT_QUICK,
+
+    // Superinstructions the Optimizer fuses the hottest sequences of int instructions into.
+    ADD_LOCAL_CONSTANT,                // GET_LOCAL, CONSTANT, ADD_INT
+    SUBTRACT_LOCAL_CONSTANT,           // GET_LOCAL, CONSTANT, SUBTRACT_INT
+    INC_LOCAL,                         // GET_LOCAL a, CONSTANT 1, ADD_INT, SET_LOCAL a, POP
+    LESS_LOCAL_CONSTANT_JUMP_IF_FALSE, // GET_LOCAL, CONSTANT, LESS_INT, JUMP_IF_FALSE, POP
+
     ARRAY,
     ARRAY_LONG,
 
@@ -72,13 +115,24 @@ enum class OpCode : uint8_t {
     RETURN,
 };
 
+// RETURN has to stay the last opcode for this to hold.
+constexpr size_t OPCODE_COUNT = static_cast<size_t>(OpCode::RETURN) + 1;
+
 std::string opCodeToString(OpCode code);
 
 class Chunk {
     std::vector<uint8_t> m_code;
     std::vector<Value> m_constants;
 
-    std::unordered_map<size_t, line_t> m_lines;
+    // The line table only stores where each run of bytes on the same line starts, sorted by offset.
+    struct LineStart {
+        size_t offset;
+        line_t line;
+    };
+
+    std::vector<LineStart> m_lines;
+
+    size_t m_maxStackDepth = 0;
 
     std::pair<std::string, size_t> disassembleSimple(size_t index) const;
     std::pair<std::string, size_t> disassembleByte(size_t index) const;
@@ -86,6 +140,7 @@ class Chunk {
     std::pair<std::string, size_t> disassembleLong(size_t index) const;
     std::pair<std::string, size_t> disassembleConstant(size_t index) const;
     std::pair<std::string, size_t> disassembleLongConstant(size_t index) const;
+    std::pair<std::string, size_t> disassembleLocalConstant(size_t index) const;
 
 public:
     Chunk() = default;
@@ -106,13 +161,23 @@ public:
     std::string disassemble() const;
     std::pair<std::string, size_t> disassembleInstruction(size_t index) const;
 
+    size_t getInstructionSize(size_t index) const;
+    int getStackEffect(size_t index) const;
+
+    // Computes how many values the code in this chunk can have on the stack at once, on top of
+    // the callee and arguments that are already there when it is called.
+    void computeMaxStackDepth();
+    size_t getMaxStackDepth() const;
+
     line_t getLine(size_t index) const;
-    line_t getCurrentLine() const;
 
     const std::vector<uint8_t>& getCode() const;
     const std::vector<Value>& getConstants() const;
 
     size_t getCount() const;
+
+    // How much memory the code, constants and line table take up outside of the chunk itself.
+    size_t getAllocatedBytes() const;
 };
 
 #endif //ENACT_CHUNK_H
@@ -4,6 +4,7 @@
 #include "../ast/Stmt.h"
 #include "Chunk.h"
 #include "Object.h"
+#include "Heap.h"
 
 struct Local {
     Token name;
@@ -23,8 +24,9 @@ enum class FunctionKind {
 };
 
 class Compiler : private StmtVisitor<void>, private ExprVisitor<void> {
-    friend class GC;
+    friend class Heap;
 
+    Heap& m_heap;
     Compiler* m_enclosing;
 
     FunctionObject* m_currentFunction{nullptr};
@@ -33,6 +35,9 @@ class Compiler : private StmtVisitor<void>, private ExprVisitor<void> {
     std::vector<Local> m_locals;
     uint32_t m_scopeDepth = 0;
 
+    // The line of the last node that was visited, which emitted code is attributed to.
+    line_t m_currentLine = 1;
+
     std::vector<Upvalue> m_upvalues{};
 
     void compile(Stmt& stmt);
@@ -71,6 +76,8 @@ class Compiler : private StmtVisitor<void>, private ExprVisitor<void> {
     void visitUnaryExpr(UnaryExpr& expr) override;
     void visitVariableExpr(VariableExpr& expr) override;
 
+    OpCode numericOp(Expr& left, Expr& right, OpCode generic, OpCode intOp, OpCode floatOp);
+
     void beginScope();
     void endScope();
 
@@ -113,7 +120,7 @@ class Compiler : private StmtVisitor<void>, private ExprVisitor<void> {
     CompileError errorAt(const Token &token, const std::string &message);
 
 public:
-    explicit Compiler(Compiler* enclosing = nullptr);
+    explicit Compiler(Heap& heap, Compiler* enclosing = nullptr);
 
     void init(FunctionKind functionKind, Type functionType, const std::string& name);
     FunctionObject* end();
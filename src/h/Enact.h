@@ -15,7 +15,8 @@ enum class ExitCode {
 };
 
 class Enact {
-    static std::string m_source;
+    // Each thread compiles and runs its own source.
+    static thread_local std::string m_source;
     static Flags m_flags;
     static std::string m_filename;
     static std::vector<std::string> m_programArgs;
@@ -23,10 +24,17 @@ class Enact {
 public:
     static void start(int argc, char *argv[]);
 
+    // Parses, analyses, compiles and optionally optimizes source into script, whose objects live in heap.
+    static InterpretResult compile(const std::string &source, Heap &heap, FunctionObject *&script);
+
     static InterpretResult run(const std::string &source);
     static void runFile(const std::string &path);
+    static void runFiles(const std::vector<std::string> &paths);
     static void runPrompt();
 
+    static std::string readFile(const std::string &path);
+
+    static void setSource(const std::string &source);
     static std::string getSourceLine(const line_t line);
 
     static void reportErrorAt(const Token &token, const std::string &message);
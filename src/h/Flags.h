@@ -6,19 +6,52 @@
 #include <unordered_map>
 #include <vector>
 #include <functional>
+#include <cstdlib>
 
 enum class Flag {
     DEBUG_PRINT_AST,
     DEBUG_DISASSEMBLE_CHUNK,
     DEBUG_TRACE_EXECUTION,
     DEBUG_STRESS_GC,
-    DEBUG_LOG_GC
+    DEBUG_LOG_GC,
+    DEBUG_LOG_OPTIMIZER,
+    OPTIMIZE,
+    PROFILE,
+    SAMPLE,
+    POOL,
+    GC_STATS
 };
 
+// Tuning for the garbage collector, set with the --gc-* flags.
+struct GCOptions {
+    // After a full collection, the next one happens once the heap has grown to this many times its live size.
+    double growthFactor = 2.0;
+
+    // How big the old generation may get before the first full collection.
+    size_t initialThreshold = 1024 * 1024;
+
+    // Running out of memory is a runtime error once the heap is still bigger than this after a full
+    // collection. Zero means there is no limit.
+    size_t maxHeapSize = 0;
+
+    // With incremental collection, full collections are split into slices of at most this many microseconds
+    // that run between allocations. Zero means full collections stop the program until they are done.
+    size_t sliceBudget = 0;
+
+    // How many threads mark and sweep big heaps when the program is stopped. Zero means one per core.
+    size_t threads = 0;
+};
+
+// The slice budget used by a plain --gc-incremental.
+constexpr size_t DEFAULT_GC_SLICE_BUDGET = 500;
+
 class Flags {
     std::unordered_set<Flag> m_flags{};
+    GCOptions m_gcOptions{};
     bool m_hadError{false};
 
+    static bool parseByteSize(const std::string& string, size_t& size);
+
 public:
     Flags() = default;
     explicit Flags(std::unordered_set<Flag> flags);
@@ -31,6 +64,8 @@ public:
     void enableFlag(Flag flag);
     void enableFlags(std::vector<Flag> flags);
 
+    const GCOptions& getGCOptions() const;
+
     bool hadError();
 
 private:
@@ -40,15 +75,53 @@ private:
             {"--debug-trace-execution",   std::bind(&Flags::enableFlag, this, Flag::DEBUG_TRACE_EXECUTION)},
             {"--debug-stress-gc",         std::bind(&Flags::enableFlag, this, Flag::DEBUG_STRESS_GC)},
             {"--debug-log-gc",            std::bind(&Flags::enableFlag, this, Flag::DEBUG_LOG_GC)},
+            {"--debug-log-optimizer",     std::bind(&Flags::enableFlag, this, Flag::DEBUG_LOG_OPTIMIZER)},
+
+            {"-O",                        std::bind(&Flags::enableFlag, this, Flag::OPTIMIZE)},
+            {"--optimize",                std::bind(&Flags::enableFlag, this, Flag::OPTIMIZE)},
+
+            {"--profile",                 std::bind(&Flags::enableFlag, this, Flag::PROFILE)},
+            {"--sample",                  std::bind(&Flags::enableFlag, this, Flag::SAMPLE)},
+
+            {"--pool",                    std::bind(&Flags::enableFlag, this, Flag::POOL)},
+
+            {"--gc-stats",                std::bind(&Flags::enableFlag, this, Flag::GC_STATS)},
+            {"--gc-incremental",          [this]() { m_gcOptions.sliceBudget = DEFAULT_GC_SLICE_BUDGET; }},
 
             {"--debug",                   std::bind(&Flags::enableFlags, this, std::vector<Flag>{
                 Flag::DEBUG_PRINT_AST,
                 Flag::DEBUG_DISASSEMBLE_CHUNK,
                 Flag::DEBUG_TRACE_EXECUTION,
                 Flag::DEBUG_STRESS_GC,
-                Flag::DEBUG_LOG_GC
+                Flag::DEBUG_LOG_GC,
+                Flag::DEBUG_LOG_OPTIMIZER
             })},
     };
+
+    // Flags that take a value, given as --flag=value. They return false if the value is invalid.
+    std::unordered_map<std::string, std::function<bool(const std::string&)>> m_valueParseTable{
+            {"--gc-growth-factor", [this](const std::string& value) {
+                char* end;
+                m_gcOptions.growthFactor = std::strtod(value.c_str(), &end);
+                return end != value.c_str() && *end == '\0' && m_gcOptions.growthFactor >= 1.0;
+            }},
+            {"--gc-initial-heap", [this](const std::string& value) {
+                return parseByteSize(value, m_gcOptions.initialThreshold);
+            }},
+            {"--gc-max-heap", [this](const std::string& value) {
+                return parseByteSize(value, m_gcOptions.maxHeapSize);
+            }},
+            {"--gc-incremental", [this](const std::string& value) {
+                char* end;
+                m_gcOptions.sliceBudget = std::strtoull(value.c_str(), &end, 10);
+                return end != value.c_str() && *end == '\0' && m_gcOptions.sliceBudget > 0;
+            }},
+            {"--gc-threads", [this](const std::string& value) {
+                char* end;
+                m_gcOptions.threads = std::strtoull(value.c_str(), &end, 10);
+                return end != value.c_str() && *end == '\0' && m_gcOptions.threads > 0;
+            }},
+    };
 };
 
 #endif //ENACT_FLAGS_H
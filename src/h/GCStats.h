@@ -0,0 +1,43 @@
+#ifndef ENACT_GCSTATS_H
+#define ENACT_GCSTATS_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include "Object.h"
+
+// Pauses are counted in buckets by their length: the first holds pauses under 1us, and bucket i those
+// from 2^(i-1)us up to 2^i us. The last bucket holds everything longer as well.
+constexpr size_t GC_PAUSE_BUCKETS = 24;
+
+// What a heap's garbage collector has done so far. Printed by --gc-stats and the gcStats() native.
+struct GCStats {
+    size_t minorCollections = 0;
+    size_t fullCollections = 0;
+    size_t incrementalSlices = 0;
+
+    // Every time the program was stopped for the collector to do some work.
+    size_t pauseCount = 0;
+    std::chrono::nanoseconds totalPause{0};
+    std::chrono::nanoseconds maxPause{0};
+    std::array<size_t, GC_PAUSE_BUCKETS> pauseHistogram{};
+
+    // Byte counts include the buffers that objects own.
+    size_t youngBytesAllocated = 0;
+    size_t oldBytesAllocated = 0;
+    size_t bytesPromoted = 0;
+    size_t bytesFreed = 0;
+
+    // The size of the old generation by object type, as it was after the last full collection.
+    std::array<size_t, OBJECT_TYPE_COUNT> liveBytes{};
+
+    void recordPause(std::chrono::nanoseconds pause);
+
+    // The share of young bytes that lived long enough to be promoted.
+    double promotionRate() const;
+
+    void print(std::ostream& stream) const;
+};
+
+#endif //ENACT_GCSTATS_H
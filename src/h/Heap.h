@@ -0,0 +1,308 @@
+#ifndef ENACT_HEAP_H
+#define ENACT_HEAP_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "Object.h"
+#include "ObjectPool.h"
+#include "GCStats.h"
+#include "StringTable.h"
+#include "Enact.h"
+
+// New objects are bump allocated in the nursery. Those that survive a minor collection are moved to the old generation.
+constexpr size_t NURSERY_SIZE = 256 * 1024;
+constexpr size_t OBJECT_ALIGNMENT = alignof(std::max_align_t);
+
+// Forwarding addresses lose their low four bits in the object header.
+static_assert(ObjectPool::SIZE_CLASS_GRANULARITY % 16 == 0, "Heap: old objects have to be aligned to 16 bytes.");
+
+// Strings longer than this are allocated straight into the old generation, so that minor collections never copy them.
+constexpr size_t MAX_YOUNG_STRING_LENGTH = 1024;
+
+// Concatenating strings makes a rope once the result is at least this long. Shorter results are just copied.
+constexpr size_t MIN_ROPE_LENGTH = 64;
+
+// While an incremental collection is underway, one slice of it runs every time this many bytes have been
+// allocated in the nursery.
+constexpr size_t GC_SLICE_INTERVAL = 16 * 1024;
+
+// How many objects a slice marks or sweeps between looking at the clock.
+constexpr size_t GC_SLICE_CHECK_INTERVAL = 64;
+
+// Marking and sweeping only use several threads once the old generation has at least this many objects.
+constexpr size_t PARALLEL_GC_MIN_OBJECTS = 64 * 1024;
+
+enum class GCPhase {
+    IDLE,
+    MARKING,
+    SWEEPING,
+};
+
+class VM;
+class Compiler;
+
+// Owns every object allocated by one interpreter session and garbage collects them. Heaps share
+// nothing with each other except objects made immutable by share(), so separate sessions can run
+// side by side, even on separate threads.
+//
+// The heap is generational. Most objects die young, so they are allocated in a small nursery that a
+// minor collection empties by moving its survivors into the old generation, without looking at any
+// other old object. Old objects that may point into the nursery are found through the write barrier.
+// The old generation is only marked and swept by a full collection, once it has grown enough.
+//
+// With --gc-incremental, full collections are split into slices that run between allocations instead.
+// Objects are marked tri-color: the grey stack holds marked objects whose references have not been looked
+// at yet. While marking, the write barrier greys any old object that is stored into another object, and
+// every object that becomes old is greyed as well, so no live object is left unmarked once the roots have
+// been marked one last time. Objects that become old while sweeping are left out of the current sweep.
+//
+// Whatever part of a collection runs while the program is stopped marks and sweeps big heaps on several
+// threads (see --gc-threads). Each marking thread has its own grey stack, and steals from the others
+// once it runs out.
+class Heap {
+    // The size of the old generation, counting the buffers its objects own as well as the objects themselves.
+    size_t m_bytesAllocated = 0;
+    size_t m_nextRun;
+
+    // The GC debugging flags are read once up front, since every allocation looks at them.
+    bool m_isStressing;
+    bool m_isLogging;
+
+    // Buffers owned by young objects live outside of the nursery, but still count towards filling it up.
+    size_t m_nurseryOwnedBytes = 0;
+
+    // So do long strings, even though they are allocated in the old generation.
+    size_t m_largeStringBytes = 0;
+
+    std::unique_ptr<uint8_t[]> m_nursery;
+    uint8_t* m_nurseryTop;
+    uint8_t* m_nurseryEnd;
+
+    // Allocating past this runs a slice of the current collection before the nursery is actually full.
+    uint8_t* m_nurseryLimit;
+
+    // The old generation. Its memory comes from the pool.
+    ObjectPool m_pool{};
+    std::vector<Object*> m_objects{};
+
+    // Interned strings are always old, so they never move.
+    StringTable m_strings{};
+
+    // Old objects that were given a reference to a young object since the last minor collection.
+    std::vector<Object*> m_rememberedSet{};
+
+    Compiler* m_currentCompiler = nullptr;
+    VM* m_currentVM = nullptr;
+
+    GCPhase m_phase = GCPhase::IDLE;
+    size_t m_bytesBeforeCollection = 0;
+
+    std::vector<Object*> m_greyStack{};
+
+    // Objects promoted by a minor collection whose own references have not been promoted yet.
+    std::vector<Object*> m_promotedStack{};
+
+    // The sweep compacts m_objects[0, m_sweepEnd) in place. Objects from m_sweepWrite up to m_sweepRead
+    // have already been moved or freed.
+    size_t m_sweepRead = 0;
+    size_t m_sweepWrite = 0;
+    size_t m_sweepEnd = 0;
+    std::array<size_t, OBJECT_TYPE_COUNT> m_sweepLiveBytes{};
+
+    GCStats m_stats{};
+
+    static constexpr size_t alignedSize(size_t size) {
+        return (size + OBJECT_ALIGNMENT - 1) & ~(OBJECT_ALIGNMENT - 1);
+    }
+
+    static size_t objectSize(const Object* object);
+    static size_t ownedBytes(Object* object);
+
+    // Makes room for a young object of this (aligned) size, collecting garbage first if need be.
+    inline uint8_t* allocateYoung(size_t size) {
+        if (m_isStressing) {
+            collectGarbage();
+        } else if (m_nurseryTop + size > m_nurseryLimit || m_nurseryOwnedBytes > NURSERY_SIZE) {
+            collectAtLimit(size);
+        }
+
+        uint8_t* memory = m_nurseryTop;
+        m_nurseryTop += size;
+        return memory;
+    }
+
+    void addOldObject(Object* object);
+    StringObject* allocateLargeString(size_t length);
+    StringObject* allocateOldString(std::string_view chars, size_t hash);
+
+    // Allocates a string whose characters are left for the caller to fill in and rehash. May collect garbage.
+    inline StringObject* allocateBlankString(size_t length) {
+        if (length > MAX_YOUNG_STRING_LENGTH) return allocateLargeString(length);
+
+        auto* string = new (allocateYoung(alignedSize(StringObject::allocationSize(length)))) StringObject{length};
+
+        if (m_isLogging) {
+            std::cout << static_cast<void *>(string) << ": allocated string of length " << length << ".\n";
+        }
+
+        return string;
+    }
+
+    void collectAtLimit(size_t size);
+    void updateNurseryLimit();
+    void collectYoung();
+    void collectFull();
+    void evacuateNursery();
+    void destroyNursery();
+    void promoteRoots();
+    Object* promote(Object* object);
+    template <typename T>
+    T* moveToPool(Object* object);
+    void promoteReference(Value& value);
+    template <typename T>
+    void promoteReference(T*& object);
+    void scanPromoted(Object* object);
+
+    void startMarking();
+    void runSlice();
+    bool markSlice(std::chrono::steady_clock::time_point deadline);
+    void finishMarking();
+    bool sweepSlice(std::chrono::steady_clock::time_point deadline);
+    void finishSweeping();
+    void checkHeapLimit();
+    size_t threadCount() const;
+
+    void markRoots();
+    void traceReferences();
+    void traceReferencesInParallel(size_t threadCount);
+    void sweepRemaining();
+    void sweepInParallel(size_t threadCount);
+    void markCompilerRoots();
+    void markVMRoots();
+    void markObject(Object* object);
+    void markValue(Value value);
+    void blackenObject(Object* object);
+    template <typename F>
+    static void forEachReference(Object* object, F&& visit);
+
+    static void destroyObject(Object* object);
+    void freeObject(Object* object);
+
+public:
+    class OutOfMemoryError : public std::runtime_error {
+    public:
+        explicit OutOfMemoryError(const std::string& message) : std::runtime_error{message} {}
+    };
+
+    Heap();
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // Allocates a young object. This may collect garbage, which moves young objects, so the arguments must not
+    // refer to objects in this heap, and callers must not hold on to young objects across the call other than
+    // through the VM's stack.
+    template <typename T, typename... Args>
+    inline T* allocateObject(Args&&... args) {
+        static_assert(std::is_base_of_v<Object, T>,
+                      "Heap::allocateObject<T>: T must derive from Object.");
+        static_assert(!std::is_same_v<T, StringObject>,
+                      "Heap::allocateObject<T>: strings are allocated with allocateString.");
+        static_assert(alignof(T) <= OBJECT_ALIGNMENT,
+                      "Heap::allocateObject<T>: T is aligned more strictly than the nursery.");
+
+        T* object = new (allocateYoung(alignedSize(sizeof(T)))) T{std::forward<Args>(args)...};
+
+        if constexpr (IsAny<T, ArrayObject, ClosureObject>::value) {
+            m_nurseryOwnedBytes += ownedBytes(object);
+        }
+
+        if (m_isLogging) {
+            std::cout << static_cast<void *>(object) << ": allocated object of size " << sizeof(T) << " and type " <<
+                      static_cast<int>(static_cast<Object *>(object)->getObjectType()) << ".\n";
+        }
+
+        return object;
+    }
+
+    // Allocates an object straight into the old generation, for objects that are known to live long, like
+    // compiled code. This never collects garbage, so the arguments may refer to any object.
+    template <typename T, typename... Args>
+    inline T* allocateOldObject(Args&&... args) {
+        static_assert(std::is_base_of_v<Object, T>,
+                      "Heap::allocateOldObject<T>: T must derive from Object.");
+        static_assert(!std::is_same_v<T, StringObject>,
+                      "Heap::allocateOldObject<T>: strings are allocated with allocateOldString.");
+
+        T* object = new (m_pool.allocate(sizeof(T))) T{std::forward<Args>(args)...};
+        addOldObject(object);
+        return object;
+    }
+
+    // Allocates a string holding a copy of chars. Short strings are young, and are allocated in one go from the
+    // nursery. Like allocateObject, this may collect garbage, so chars must not point into this heap.
+    inline StringObject* allocateString(std::string_view chars) {
+        StringObject* string = allocateBlankString(chars.size());
+        std::memcpy(string->chars(), chars.data(), chars.size());
+        string->rehash();
+        return string;
+    }
+
+    // Allocates a string straight into the old generation. This never collects garbage, so chars may point
+    // into this heap.
+    StringObject* allocateOldString(std::string_view chars);
+
+    inline bool isYoung(const Object* object) const {
+        return reinterpret_cast<uintptr_t>(object) - reinterpret_cast<uintptr_t>(m_nursery.get()) < NURSERY_SIZE;
+    }
+
+    // Has to be called whenever a reference to value is stored in an object that may already be old.
+    inline void writeBarrier(Object* object, Value value) {
+        if (value.isObject()) writeBarrier(object, value.asObject());
+    }
+
+    inline void writeBarrier(Object* object, Object* value) {
+        if (isYoung(value)) {
+            if (!isYoung(object) && !object->isRemembered()) remember(object);
+        } else if (m_phase == GCPhase::MARKING) {
+            markObject(value);
+        }
+    }
+
+    // Returns the heap's one interned string with these contents, allocating it if there isn't one yet.
+    // Interned strings can be compared by their address. Like allocateOldObject, this never collects garbage.
+    StringObject* internString(std::string_view chars);
+
+    // Concatenates two strings or ropes. Long results are ropes, which share their halves instead of copying them.
+    // This may collect garbage, so left and right have to be roots that collections update, like the VM's stack.
+    Object* concatenate(const Value& left, const Value& right);
+
+    // Puts the characters of a rope together into a string the first time it is called, and returns that string
+    // from then on. Like concatenate, this may collect garbage, so rope has to be a root.
+    StringObject* flatten(const Value& rope);
+
+    // Makes the next minor collection look for young objects inside of object.
+    void remember(Object* object);
+
+    // Collects both generations, finishing any incremental collection that is underway first. Throws
+    // OutOfMemoryError if the heap is still bigger than --gc-max-heap afterwards.
+    void collectGarbage();
+
+    std::vector<ObjectPool::SizeClassStats> getPoolStats() const;
+    GCStats getStats() const;
+
+    void freeObjects();
+
+    // Makes every object allocated so far shared. They stay alive until this heap is destroyed, and
+    // other heaps may reference them without ever touching them.
+    void share();
+
+    void setCompiler(Compiler* compiler);
+    void setVM(VM* vm);
+};
+
+#endif //ENACT_HEAP_H
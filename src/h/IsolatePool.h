@@ -0,0 +1,70 @@
+#ifndef ENACT_ISOLATEPOOL_H
+#define ENACT_ISOLATEPOOL_H
+
+#include "Heap.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// A compiled program. Its objects are shared and are never written to after compilation, so any number
+// of isolates can run it at the same time.
+class Script {
+    std::string m_source;
+    Heap m_heap{};
+    FunctionObject* m_function = nullptr;
+
+    InterpretResult m_compileResult;
+    std::chrono::nanoseconds m_compileTime{};
+
+public:
+    explicit Script(std::string source);
+
+    const std::string& getSource() const;
+    FunctionObject* getFunction() const;
+
+    InterpretResult getCompileResult() const;
+    std::chrono::nanoseconds getCompileTime() const;
+};
+
+struct IsolateResult {
+    InterpretResult result;
+    std::chrono::nanoseconds compileTime;
+    std::chrono::nanoseconds runTime;
+    GCStats gcStats;
+};
+
+// Runs scripts on a fixed set of worker threads. Every run gets an isolate of its own, a fresh VM and heap,
+// so the only thing runs have in common is the compiled Script they were given.
+class IsolatePool {
+    std::vector<std::thread> m_workers{};
+
+    std::deque<std::function<void()>> m_tasks{};
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    bool m_stopping = false;
+
+    void workerLoop();
+    void enqueue(std::function<void()> task);
+
+public:
+    explicit IsolatePool(size_t threadCount = std::thread::hardware_concurrency());
+    ~IsolatePool();
+
+    IsolatePool(const IsolatePool&) = delete;
+    IsolatePool& operator=(const IsolatePool&) = delete;
+
+    // Runs a script that has already been compiled, possibly while other isolates run it too.
+    std::future<IsolateResult> run(std::shared_ptr<const Script> script);
+
+    // Compiles and runs source on one of the workers.
+    std::future<IsolateResult> run(std::string source);
+
+    size_t getThreadCount() const;
+};
+
+#endif //ENACT_ISOLATEPOOL_H
@@ -1,12 +1,35 @@
 #ifndef ENACT_NATIVES_H
 #define ENACT_NATIVES_H
 
+#include <stdexcept>
 #include "Value.h"
 
+class VM;
+
 namespace Natives {
-    Value print(uint8_t argCount, Value* args);
-    Value put(uint8_t argCount, Value* args);
-    Value dis(uint8_t argCount, Value* args);
+    // Thrown by natives that were given arguments they can't work with. The VM reports it as a runtime error.
+    class Error : public std::runtime_error {
+    public:
+        explicit Error(const std::string& message) : std::runtime_error{message} {}
+    };
+
+    Value print(VM& vm, uint8_t argCount, Value* args);
+    Value put(VM& vm, uint8_t argCount, Value* args);
+    Value dis(VM& vm, uint8_t argCount, Value* args);
+    Value gcStats(VM& vm, uint8_t argCount, Value* args);
+
+    // Bulk operations on int and float arrays, which run on their unboxed elements. See ArrayKernels.h.
+    Value sum(VM& vm, uint8_t argCount, Value* args);
+    Value min(VM& vm, uint8_t argCount, Value* args);
+    Value max(VM& vm, uint8_t argCount, Value* args);
+    Value dot(VM& vm, uint8_t argCount, Value* args);
+    Value add(VM& vm, uint8_t argCount, Value* args);
+    Value mul(VM& vm, uint8_t argCount, Value* args);
+
+    // These work on any array.
+    Value fill(VM& vm, uint8_t argCount, Value* args);
+    Value indexOf(VM& vm, uint8_t argCount, Value* args);
+    Value count(VM& vm, uint8_t argCount, Value* args);
 }
 
 #endif //ENACT_NATIVES_H
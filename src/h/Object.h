@@ -1,12 +1,16 @@
 #ifndef ENACT_OBJECT_H
 #define ENACT_OBJECT_H
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <string_view>
 #include "Type.h"
 #include "Value.h"
 
-enum class ObjectType {
+enum class ObjectType : uint8_t {
     STRING,
+    ROPE,
     ARRAY,
     UPVALUE,
     CLOSURE,
@@ -15,7 +19,10 @@ enum class ObjectType {
     TYPE
 };
 
+constexpr size_t OBJECT_TYPE_COUNT = static_cast<size_t>(ObjectType::TYPE) + 1;
+
 class StringObject;
+class RopeObject;
 class ArrayObject;
 class UpvalueObject;
 class ClosureObject;
@@ -24,16 +31,52 @@ class NativeObject;
 class TypeObject;
 
 class VM;
+class Heap;
 
+// Objects have no vtable. Everything that depends on an object's class dispatches on the type in its header
+// instead, so the header is a single word.
 class Object {
-    friend class GC;
+    friend class Heap;
+
+    // The type is in the low byte, followed by the flags below. Once a young object has been promoted, the
+    // address it was moved to is kept in the high bits. Objects are aligned to at least 16 bytes, so the
+    // address loses nothing by being shifted.
+    //
+    // Atomic, since the heap may mark objects on several threads at once. Nothing else ever changes while it does.
+    std::atomic<uint64_t> m_header;
+
+    static constexpr uint64_t TYPE_MASK = 0xff;
+    static constexpr uint64_t MARKED = 1 << 8;
+
+    // Shared objects belong to compiled code that several heaps run at once. Only the heap that
+    // allocated them may free them, and no heap ever marks them.
+    static constexpr uint64_t SHARED = 1 << 9;
+
+    // Set on old objects that may point into the nursery. See Heap::writeBarrier.
+    static constexpr uint64_t REMEMBERED = 1 << 10;
+
+    // Set on strings that are in their heap's string table. See Heap::internString.
+    static constexpr uint64_t INTERNED = 1 << 11;
 
-    ObjectType m_type;
-    bool m_isMarked{false};
+    static constexpr uint64_t FLAGS_MASK = 0xffff;
+    static constexpr int FORWARDING_ADDRESS_SHIFT = 12;
+
+    inline uint64_t header() const;
+    inline void setFlag(uint64_t flag, bool value);
+
+    inline bool isRemembered() const;
+    inline void setRemembered(bool isRemembered);
+
+    inline Object* getForwardingAddress() const;
+    inline void setForwardingAddress(Object* address);
 
 public:
     explicit Object(ObjectType type);
-    virtual ~Object();
+
+    // Copies only the type: a copy starts out unmarked, unshared and young.
+    Object(const Object& object);
+
+    inline ObjectType getObjectType() const;
 
     template <typename T>
     inline bool is() const;
@@ -44,38 +87,108 @@ public:
     template <typename T>
     inline const T* as() const;
 
+    // Calls visitor with this object cast to its actual class.
+    template <typename F>
+    inline decltype(auto) visit(F&& visitor);
+
+    template <typename F>
+    inline decltype(auto) visit(F&& visitor) const;
+
     bool operator==(const Object& object) const;
 
-    virtual void mark();
-    virtual void unmark();
-    virtual bool isMarked();
+    // Returns false if the object was already marked.
+    inline bool mark();
+    inline void unmark();
+    inline bool isMarked() const;
+
+    void share();
+    bool isShared() const;
+
+    inline bool isInterned() const;
 
-    virtual std::string toString() const = 0;
-    virtual Type getType() const = 0;
-    virtual Object* clone() const = 0;
+    // Ropes are strings too, as far as the language is concerned.
+    inline bool isString() const;
+    size_t stringLength() const;
+
+    std::string toString() const;
+    Type getType() const;
+    Object* clone(Heap& heap) const;
 };
 
+static_assert(sizeof(Object) == sizeof(uint64_t), "Object: the header should be a single word.");
+
 std::ostream& operator<<(std::ostream& stream, const Object& object);
 
+inline uint64_t Object::header() const {
+    return m_header.load(std::memory_order_relaxed);
+}
+
+inline void Object::setFlag(uint64_t flag, bool value) {
+    m_header.store(value ? header() | flag : header() & ~flag, std::memory_order_relaxed);
+}
+
+inline bool Object::isRemembered() const {
+    return (header() & REMEMBERED) != 0;
+}
+
+inline void Object::setRemembered(bool isRemembered) {
+    setFlag(REMEMBERED, isRemembered);
+}
+
+inline Object* Object::getForwardingAddress() const {
+    return reinterpret_cast<Object*>((header() & ~FLAGS_MASK) >> FORWARDING_ADDRESS_SHIFT);
+}
+
+inline void Object::setForwardingAddress(Object* address) {
+    m_header.store((header() & FLAGS_MASK) | reinterpret_cast<uintptr_t>(address) << FORWARDING_ADDRESS_SHIFT,
+            std::memory_order_relaxed);
+}
+
+inline ObjectType Object::getObjectType() const {
+    return static_cast<ObjectType>(header() & TYPE_MASK);
+}
+
+inline bool Object::mark() {
+    return (header() & MARKED) == 0 && (m_header.fetch_or(MARKED, std::memory_order_relaxed) & MARKED) == 0;
+}
+
+inline void Object::unmark() {
+    setFlag(MARKED, false);
+}
+
+inline bool Object::isMarked() const {
+    return (header() & MARKED) != 0;
+}
+
+inline bool Object::isInterned() const {
+    return (header() & INTERNED) != 0;
+}
+
+inline bool Object::isString() const {
+    return getObjectType() == ObjectType::STRING || getObjectType() == ObjectType::ROPE;
+}
+
 template<typename T>
 inline bool Object::is() const {
     static_assert(std::is_base_of_v<Object, T>,
                   "Object::is<T>: T must derive from Object.");
 
     if (std::is_same_v<T, StringObject>) {
-        return m_type == ObjectType::STRING;
+        return getObjectType() == ObjectType::STRING;
+    } else if (std::is_same_v<T, RopeObject>) {
+        return getObjectType() == ObjectType::ROPE;
     } else if (std::is_same_v<T, ArrayObject>) {
-        return m_type == ObjectType::ARRAY;
+        return getObjectType() == ObjectType::ARRAY;
     } else if (std::is_same_v<T, UpvalueObject>) {
-        return m_type == ObjectType::UPVALUE;
+        return getObjectType() == ObjectType::UPVALUE;
     } else if (std::is_same_v<T, ClosureObject>) {
-        return m_type == ObjectType::CLOSURE;
+        return getObjectType() == ObjectType::CLOSURE;
     } else if (std::is_same_v<T, FunctionObject>) {
-        return m_type == ObjectType::FUNCTION;
+        return getObjectType() == ObjectType::FUNCTION;
     } else if (std::is_same_v<T, NativeObject>) {
-        return m_type == ObjectType::NATIVE;
+        return getObjectType() == ObjectType::NATIVE;
     } else if (std::is_same_v<T, TypeObject>) {
-        return m_type == ObjectType::TYPE;
+        return getObjectType() == ObjectType::TYPE;
     }
 
     return false;
@@ -96,49 +209,137 @@ inline const T* Object::as() const {
     return static_cast<const T*>(this);
 }
 
-
+// The characters are stored right after the object, so that a string is a single allocation. Only the heap
+// makes strings, since it has to leave room for them.
 class StringObject : public Object {
-    std::string m_data;
+    friend class Heap;
+
+    size_t m_hash;
+    size_t m_length;
+
+    StringObject(std::string_view chars, size_t hash);
+
+    // Leaves the characters for the heap to fill in, and to rehash afterwards.
+    explicit StringObject(size_t length);
+
+    char* chars();
+    void rehash();
 
 public:
-    explicit StringObject(std::string data);
-    ~StringObject() override = default;
+    StringObject(const StringObject&) = delete;
+    StringObject& operator=(const StringObject&) = delete;
 
-    const std::string& asStdString() const;
+    // The size of a string of this length, including a terminating null character.
+    static constexpr size_t allocationSize(size_t length) {
+        return sizeof(StringObject) + length + 1;
+    }
 
-    std::string toString() const override;
-    Type getType() const override;
-    StringObject* clone() const override;
+    size_t length() const;
+    const char* getChars() const;
+    std::string_view asStringView() const;
+    size_t getHash() const;
+
+    static size_t hashString(std::string_view chars);
+
+    std::string toString() const;
+    Type getType() const;
+    StringObject* clone(Heap& heap) const;
+};
+
+// The result of concatenating two strings that are too long to copy right away. The characters are only put
+// together once the VM looks at them (see Heap::flatten), so building a long string piece by piece is linear.
+class RopeObject : public Object {
+    friend class Heap;
+
+    // Each half is a string or another rope. Once the rope has been flattened, the left half is the flat
+    // string and the right half is null.
+    Object* m_left = nullptr;
+    Object* m_right = nullptr;
+    size_t m_length;
+
+public:
+    explicit RopeObject(size_t length);
+
+    size_t length() const;
+    bool isFlat() const;
+
+    // The string the rope was flattened into, or null if it has not been flattened yet.
+    const StringObject* getFlat() const;
+
+    // Writes all length() characters to out, without allocating anything in the heap.
+    void copyChars(char* out) const;
+
+    std::string toString() const;
+    Type getType() const;
+    StringObject* clone(Heap& heap) const;
 };
 
 class Value;
 
+// How an array holds its elements. Arrays whose element type is int, float or bool keep them unboxed, which
+// takes less memory and lets them be worked on in bulk. Everything else is kept as values.
+enum class ArrayStorage : uint8_t {
+    VALUE,
+    INT,
+    FLOAT,
+    BOOL,
+};
+
 class ArrayObject : public Object {
-    std::vector<Value> m_vector;
+    friend class Heap;
+
     Type m_type;
+    ArrayStorage m_storage;
+    size_t m_length;
+
+    // The elements, packed as m_storage says. Bools take up a single bit each.
+    std::unique_ptr<uint64_t[]> m_data;
+
+    static size_t wordCount(ArrayStorage storage, size_t length);
 
 public:
     explicit ArrayObject(Type type);
     explicit ArrayObject(size_t length, Type type);
-    explicit ArrayObject(std::vector<Value> vector, Type type);
+    explicit ArrayObject(const std::vector<Value>& values, Type type);
+    ArrayObject(const ArrayObject& array);
+    ArrayObject(ArrayObject&& array) = default;
 
-    ~ArrayObject() override = default;
+    // Picks the storage for arrays of the given array type.
+    static ArrayStorage storageFor(const Type& type);
 
     size_t length() const;
+    ArrayStorage getStorage() const;
+    size_t getAllocatedBytes() const;
+
+    // The elements themselves, as the type that getStorage() says they are stored as. Bools are packed
+    // into uint64_t words.
+    template <typename T>
+    inline T* getData();
+    template <typename T>
+    inline const T* getData() const;
+
+    inline Value get(size_t index) const;
 
-    Value& at(size_t index);
-    const Value& at(size_t index) const;
+    // Whether the value can be stored in this array without changing it. Unboxed arrays only take values of
+    // their element type, except that float arrays take ints as well.
+    inline bool canHold(const Value& value) const;
 
-    void append(Value value);
+    // Float arrays widen ints to floats. The caller has to check canHold() first.
+    inline void set(size_t index, Value value);
 
-    const std::vector<Value>& asVector() const;
+    // Sets every element to value, converting it like set does.
+    void fill(Value value);
 
-    std::string toString() const override;
-    Type getType() const override;
-    ArrayObject* clone() const override;
+    bool operator==(const ArrayObject& array) const;
+
+    std::string toString() const;
+    Type getType() const;
+    ArrayObject* clone(Heap& heap) const;
 };
 
 class UpvalueObject : public Object {
+    friend class Heap;
+
     uint32_t m_location;
     UpvalueObject* m_next = nullptr;
 
@@ -147,7 +348,6 @@ class UpvalueObject : public Object {
 
 public:
     explicit UpvalueObject(uint32_t location);
-    ~UpvalueObject() override = default;
 
     uint32_t getLocation();
     UpvalueObject* getNext();
@@ -157,25 +357,26 @@ public:
     Value getClosed() const;
     void setClosed(Value value);
 
-    std::string toString() const override;
-    Type getType() const override;
-    UpvalueObject* clone() const override;
+    std::string toString() const;
+    Type getType() const;
+    UpvalueObject* clone(Heap& heap) const;
 };
 
 class ClosureObject : public Object {
+    friend class Heap;
+
     FunctionObject* m_function{nullptr};
     std::vector<UpvalueObject*> m_upvalues{};
 
 public:
     explicit ClosureObject(FunctionObject* function);
-    ~ClosureObject() override = default;
 
     FunctionObject* getFunction();
     std::vector<UpvalueObject*>& getUpvalues();
 
-    std::string toString() const override;
-    Type getType() const override;
-    ClosureObject* clone() const override;
+    std::string toString() const;
+    Type getType() const;
+    ClosureObject* clone(Heap& heap) const;
 };
 
 #include "Chunk.h"
@@ -188,18 +389,17 @@ class FunctionObject : public Object {
 
 public:
     explicit FunctionObject(Type type, Chunk chunk, std::string name);
-    ~FunctionObject() override = default;
 
     Chunk& getChunk();
     const std::string& getName() const;
     uint32_t& getUpvalueCount();
 
-    std::string toString() const override;
-    Type getType() const override;
-    FunctionObject* clone() const override;
+    std::string toString() const;
+    Type getType() const;
+    FunctionObject* clone(Heap& heap) const;
 };
 
-typedef Value (*NativeFn)(uint8_t argCount, Value* args);
+typedef Value (*NativeFn)(VM& vm, uint8_t argCount, Value* args);
 
 class NativeObject : public Object {
     Type m_type{nullptr};
@@ -207,13 +407,12 @@ class NativeObject : public Object {
 
 public:
     explicit NativeObject(Type type, NativeFn function);
-    ~NativeObject() override = default;
 
     NativeFn getFunction();
 
-    std::string toString() const override;
-    Type getType() const override;
-    NativeObject* clone() const override;
+    std::string toString() const;
+    Type getType() const;
+    NativeObject* clone(Heap& heap) const;
 };
 
 class TypeObject : public Object {
@@ -221,13 +420,96 @@ class TypeObject : public Object {
 
 public:
     explicit TypeObject(Type containedType);
-    ~TypeObject() override = default;
 
     Type getContainedType();
 
-    std::string toString() const override;
-    Type getType() const override;
-    TypeObject* clone() const override;
+    std::string toString() const;
+    Type getType() const;
+    TypeObject* clone(Heap& heap) const;
 };
 
+template <typename T>
+inline T* ArrayObject::getData() {
+    return reinterpret_cast<T*>(m_data.get());
+}
+
+template <typename T>
+inline const T* ArrayObject::getData() const {
+    return reinterpret_cast<const T*>(m_data.get());
+}
+
+inline Value ArrayObject::get(size_t index) const {
+    switch (m_storage) {
+        case ArrayStorage::INT: return Value{getData<int32_t>()[index]};
+        case ArrayStorage::FLOAT: return Value{getData<double>()[index]};
+        case ArrayStorage::BOOL: return Value{((getData<uint64_t>()[index / 64] >> (index % 64)) & 1) != 0};
+        case ArrayStorage::VALUE: break;
+    }
+
+    return getData<Value>()[index];
+}
+
+inline bool ArrayObject::canHold(const Value& value) const {
+    switch (m_storage) {
+        case ArrayStorage::INT: return value.isInt();
+        case ArrayStorage::FLOAT: return value.isDouble() || value.isInt();
+        case ArrayStorage::BOOL: return value.isBool();
+        case ArrayStorage::VALUE: break;
+    }
+
+    return true;
+}
+
+inline void ArrayObject::set(size_t index, Value value) {
+    switch (m_storage) {
+        case ArrayStorage::INT:
+            getData<int32_t>()[index] = value.asInt();
+            break;
+        case ArrayStorage::FLOAT:
+            getData<double>()[index] = value.isDouble() ? value.asDouble() : static_cast<double>(value.asInt());
+            break;
+        case ArrayStorage::BOOL: {
+            uint64_t bit = uint64_t{1} << (index % 64);
+            uint64_t& word = getData<uint64_t>()[index / 64];
+            word = value.asBool() ? word | bit : word & ~bit;
+            break;
+        }
+        case ArrayStorage::VALUE:
+            getData<Value>()[index] = value;
+            break;
+    }
+}
+
+template <typename F>
+inline decltype(auto) Object::visit(F&& visitor) {
+    switch (getObjectType()) {
+        case ObjectType::STRING: return visitor(as<StringObject>());
+        case ObjectType::ROPE: return visitor(as<RopeObject>());
+        case ObjectType::ARRAY: return visitor(as<ArrayObject>());
+        case ObjectType::UPVALUE: return visitor(as<UpvalueObject>());
+        case ObjectType::CLOSURE: return visitor(as<ClosureObject>());
+        case ObjectType::FUNCTION: return visitor(as<FunctionObject>());
+        case ObjectType::NATIVE: return visitor(as<NativeObject>());
+        case ObjectType::TYPE: return visitor(as<TypeObject>());
+    }
+
+    ENACT_ABORT("Unreachable: unknown object type in Object::visit.");
+}
+
+template <typename F>
+inline decltype(auto) Object::visit(F&& visitor) const {
+    switch (getObjectType()) {
+        case ObjectType::STRING: return visitor(as<StringObject>());
+        case ObjectType::ROPE: return visitor(as<RopeObject>());
+        case ObjectType::ARRAY: return visitor(as<ArrayObject>());
+        case ObjectType::UPVALUE: return visitor(as<UpvalueObject>());
+        case ObjectType::CLOSURE: return visitor(as<ClosureObject>());
+        case ObjectType::FUNCTION: return visitor(as<FunctionObject>());
+        case ObjectType::NATIVE: return visitor(as<NativeObject>());
+        case ObjectType::TYPE: return visitor(as<TypeObject>());
+    }
+
+    ENACT_ABORT("Unreachable: unknown object type in Object::visit.");
+}
+
 #endif //ENACT_OBJECT_H
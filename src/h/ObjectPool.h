@@ -0,0 +1,80 @@
+#ifndef ENACT_OBJECTPOOL_H
+#define ENACT_OBJECTPOOL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Memory for old objects. Objects are grouped into size classes, and every class packs its objects into
+// pages of equally sized slots. Freed slots are kept on a per-class free list and reused by the next
+// allocation of that class, so allocating and freeing only go through malloc when a page is added.
+class ObjectPool {
+public:
+    static constexpr size_t PAGE_SIZE = 16 * 1024;
+    static constexpr size_t SIZE_CLASS_GRANULARITY = 16;
+    static constexpr size_t SIZE_CLASS_COUNT = 16;
+
+    // Anything bigger than this is allocated on its own with operator new.
+    static constexpr size_t MAX_SLOT_SIZE = SIZE_CLASS_GRANULARITY * SIZE_CLASS_COUNT;
+
+    struct SizeClassStats {
+        size_t slotSize;
+        size_t slotsPerPage;
+        size_t usedSlots;
+
+        // How many slots are in use in each of the class' pages.
+        std::vector<size_t> pageOccupancy;
+    };
+
+private:
+    // Lives at the start of every page. Pages are aligned to PAGE_SIZE, so a slot finds its page by masking its address.
+    struct Page {
+        size_t usedSlots;
+    };
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct SizeClass {
+        std::vector<Page*> pages{};
+        FreeSlot* freeList = nullptr;
+
+        // Slots in the newest page that have never been handed out.
+        uint8_t* unusedBegin = nullptr;
+        uint8_t* unusedEnd = nullptr;
+
+        size_t usedSlots = 0;
+    };
+
+    static constexpr size_t PAGE_HEADER_SIZE = (sizeof(Page) + SIZE_CLASS_GRANULARITY - 1) & ~(SIZE_CLASS_GRANULARITY - 1);
+
+    std::array<SizeClass, SIZE_CLASS_COUNT> m_sizeClasses{};
+
+    static size_t sizeClassIndex(size_t size);
+    static size_t slotSize(size_t index);
+    static Page* pageOf(void* slot);
+
+    void addPage(SizeClass& sizeClass, size_t slotSize);
+
+public:
+    ObjectPool() = default;
+    ~ObjectPool();
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    void* allocate(size_t size);
+
+    // Size has to be the same as when the memory was allocated.
+    void free(void* memory, size_t size);
+
+    // Gives every page back at once. Objects in them have to have been destroyed already.
+    void releaseAll();
+
+    // One entry for every size class that has at least one page.
+    std::vector<SizeClassStats> getStats() const;
+};
+
+#endif //ENACT_OBJECTPOOL_H
@@ -0,0 +1,66 @@
+#ifndef ENACT_OPTIMIZER_H
+#define ENACT_OPTIMIZER_H
+
+#include "Chunk.h"
+#include "Object.h"
+
+#include <optional>
+
+// Rewrites the bytecode produced by the Compiler into an equivalent but shorter sequence of instructions.
+// Passes:
+// - constant folding of arithmetic, comparisons and negation on literal operands,
+// - removal of runtime type checks whose outcome is already known,
+// - folding comparison + NOT into a single comparison opcode,
+// - removal of values that are pushed and immediately popped,
+// - jump threading, so that jumps go straight to their final destination,
+// - fusing the hottest sequences of int instructions into superinstructions.
+
+class Optimizer {
+    // A decoded instruction. Jumps refer to their destination by instruction index rather than
+    // byte offset, so that instructions can be removed without breaking them.
+    struct Instruction {
+        OpCode op;
+        std::vector<uint8_t> operands;
+        line_t line;
+        size_t target;
+        bool removed;
+    };
+
+    std::vector<Instruction> m_instructions;
+    std::vector<bool> m_isJumpTarget;
+
+    Chunk* m_chunk;
+
+    size_t m_instructionsBefore = 0;
+    size_t m_instructionsAfter = 0;
+
+    void optimizeChunk(Chunk& chunk, const std::string& name);
+
+    void decode(Chunk& chunk);
+    std::optional<Chunk> encode() const;
+
+    void findJumpTargets();
+    void compact();
+
+    bool foldConstants();
+    bool removeRedundantChecks();
+    bool fuseComparisons();
+    bool removeDeadPushes();
+    bool threadJumps();
+    bool fuseSuperinstructions();
+
+    size_t next(size_t index) const;
+    std::optional<Value> getConstant(size_t index) const;
+    void setConstant(size_t index, Value value);
+
+public:
+    Optimizer() = default;
+
+    // Optimizes the function and every function nested inside of it.
+    void optimize(FunctionObject* function);
+
+    size_t getInstructionsBefore() const;
+    size_t getInstructionsAfter() const;
+};
+
+#endif //ENACT_OPTIMIZER_H
@@ -0,0 +1,63 @@
+#ifndef ENACT_PROFILER_H
+#define ENACT_PROFILER_H
+
+#include "Chunk.h"
+#include "Object.h"
+
+#include <array>
+
+// Where --profile writes the JSON version of its report.
+constexpr const char* PROFILE_PATH = "enact-profile.json";
+
+// Counts how many times every instruction is executed and how many cycles are spent in it,
+// broken down by opcode, by function and by source line. The VM only calls into this from its
+// profiling specialization, so it costs nothing when --profile is off.
+class Profiler {
+    struct Counter {
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+    };
+
+    struct FunctionProfile {
+        std::string name;
+        Counter total;
+
+        // Indexed by the offset of the instruction in the function's chunk. Lines are only looked
+        // up when the report is made.
+        std::vector<Counter> instructions;
+    };
+
+    struct Row {
+        std::string name;
+        Counter counter;
+    };
+
+    std::array<Counter, OPCODE_COUNT> m_opCodes{};
+    std::unordered_map<FunctionObject*, FunctionProfile> m_functions{};
+
+    // The instruction that is executing right now. It is charged for the cycles up to the start of the next one.
+    FunctionObject* m_currentFunctionObject = nullptr;
+    FunctionProfile* m_currentFunction = nullptr;
+    Counter* m_currentOpCode = nullptr;
+    Counter* m_currentInstruction = nullptr;
+    uint64_t m_start = 0;
+
+    static uint64_t readCycles();
+    void charge(uint64_t now);
+
+    Counter getTotal() const;
+    std::vector<Row> getOpCodeRows() const;
+    std::vector<Row> getFunctionRows() const;
+    std::vector<std::pair<line_t, Counter>> getLineCounters() const;
+
+public:
+    Profiler() = default;
+
+    void recordInstruction(FunctionObject* function, size_t offset);
+    void stop();
+
+    void printReport(std::ostream& stream) const;
+    void writeJson(std::ostream& stream) const;
+};
+
+#endif //ENACT_PROFILER_H
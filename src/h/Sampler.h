@@ -0,0 +1,75 @@
+#ifndef ENACT_SAMPLER_H
+#define ENACT_SAMPLER_H
+
+#include "VM.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// Where --sample writes the stacks it collected.
+constexpr const char* SAMPLE_PATH = "enact-profile.folded";
+
+// A statistical profiler. A SIGPROF timer interrupts the VM every SAMPLE_INTERVAL_US of CPU time, and the
+// signal handler copies the VM's call stack into a lock-free ring buffer. A background thread drains the
+// buffer, and at the end the stacks are written in the folded format that flame graph tools read.
+class Sampler {
+    static constexpr long SAMPLE_INTERVAL_US = 1000;
+
+    // Has to be a power of two.
+    static constexpr size_t BUFFER_CAPACITY = 1024;
+
+    struct Sample {
+        size_t depth;
+        std::array<FunctionObject*, FRAMES_MAX> functions;
+        std::array<uint32_t, FRAMES_MAX> offsets;
+    };
+
+    using Stack = std::vector<std::pair<FunctionObject*, uint32_t>>;
+
+    static_assert(std::atomic<size_t>::is_always_lock_free,
+            "Sampler: the signal handler needs lock-free atomics.");
+    static_assert((BUFFER_CAPACITY & (BUFFER_CAPACITY - 1)) == 0,
+            "Sampler: BUFFER_CAPACITY must be a power of two.");
+
+    static std::atomic<Sampler*> m_current;
+
+    const VM* m_vm = nullptr;
+
+    // Written only by the signal handler (m_head, m_dropped) and the drain thread (m_tail).
+    std::unique_ptr<Sample[]> m_buffer;
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+    std::atomic<size_t> m_dropped{0};
+
+    std::map<Stack, size_t> m_stacks{};
+    size_t m_sampleCount = 0;
+
+    std::thread m_drainThread;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    bool m_running = false;
+
+    static void handleSignal(int signal);
+    void takeSample();
+
+    void drainLoop();
+    void drain();
+
+public:
+    Sampler();
+    ~Sampler();
+
+    // Starts sampling the stack of the given VM. Returns false if sampling isn't supported on this platform.
+    bool start(const VM& vm);
+    void stop();
+
+    size_t getSampleCount() const;
+    size_t getDroppedCount() const;
+
+    void writeFolded(std::ostream& stream) const;
+};
+
+#endif //ENACT_SAMPLER_H
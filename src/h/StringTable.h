@@ -0,0 +1,39 @@
+#ifndef ENACT_STRINGTABLE_H
+#define ENACT_STRINGTABLE_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+class StringObject;
+
+// A heap's interned strings, looked up by their contents. The table doesn't keep its strings alive: the
+// heap removes the ones that weren't marked before it sweeps them.
+class StringTable {
+    // Open addressing with linear probing. Removed entries are replaced by a tombstone, so that probes for
+    // strings further along still go past them.
+    std::vector<StringObject*> m_entries{};
+
+    // Live entries, and live entries plus tombstones.
+    size_t m_size = 0;
+    size_t m_used = 0;
+
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    static StringObject* tombstone();
+
+    void grow();
+
+public:
+    StringObject* find(std::string_view chars, size_t hash) const;
+
+    // The string must not be in the table already.
+    void insert(StringObject* string);
+
+    void removeUnmarked();
+    void clear();
+
+    size_t size() const;
+};
+
+#endif //ENACT_STRINGTABLE_H
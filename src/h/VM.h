@@ -6,9 +6,11 @@
 #include "Chunk.h"
 #include "Object.h"
 
+#include <array>
 #include <optional>
 
 constexpr size_t FRAMES_MAX = 64;
+constexpr size_t STACK_MAX = FRAMES_MAX * (UINT8_MAX + 1);
 
 enum class InterpretResult {
     PARSE_ERROR,
@@ -24,25 +26,53 @@ struct CallFrame {
     size_t slotsBegin;
 };
 
+class Profiler;
+
+class Heap;
+
 class VM {
-    friend class GC;
+    friend class Heap;
+    friend class Sampler;
+
+    Heap& m_heap;
 
-    std::vector<Value> m_stack;
+    // The value stack is allocated once and never moves, so pointers into it stay valid.
+    std::unique_ptr<Value[]> m_stack;
+    Value* m_stackTop;
 
     std::array<CallFrame, FRAMES_MAX> m_frames{CallFrame{nullptr, nullptr, 0}};
     size_t m_frameCount = 0;
 
     UpvalueObject* m_openUpvalues = nullptr;
+
+    Profiler* m_profiler = nullptr;
+
+    // Shared bytecode may be running on other threads, so it is never quickened in place.
+    bool m_canQuicken = true;
+
+    template <bool isTracing, bool isProfiling>
+    InterpretResult execute();
+
+    void traceInstruction(CallFrame* frame);
+
+    // Reports a value that cannot be stored in the given array.
+    void allotError(const ArrayObject& array, const Value& value);
 public:
-    VM();
+    explicit VM(Heap& heap);
+    ~VM();
+
+    Heap& getHeap();
 
     InterpretResult run(FunctionObject* function);
 
+    // Every instruction run() executes is recorded in the profiler, if one is set.
+    void setProfiler(Profiler* profiler);
+
     void push(Value value);
     Value pop();
     Value peek(size_t depth);
 
-    void call(ClosureObject* closure);
+    bool call(ClosureObject* closure);
 
     UpvalueObject* captureUpvalue(uint32_t location);
     void closeUpvalues(uint32_t last);
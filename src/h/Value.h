@@ -1,7 +1,9 @@
 #ifndef ENACT_VALUE_H
 #define ENACT_VALUE_H
 
+#include <cstring>
 #include <variant>
+#include "common.h"
 #include "Type.h"
 
 class Object;
@@ -15,6 +17,23 @@ enum class ValueType {
 };
 
 class Value {
+#ifdef ENACT_NAN_BOXING_ENABLED
+    // Every value is packed into a single 64-bit word. Anything that isn't a quiet NaN with
+    // all of the bits in QNAN set is a double. The remaining encodings are:
+    //   nil:    QNAN | TAG_NIL
+    //   bool:   QNAN | TAG_FALSE / TAG_TRUE
+    //   int:    QNAN | INT_TAG | 32-bit payload
+    //   object: QNAN | SIGN_BIT | 48-bit pointer
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t INT_TAG = 0x0002000000000000;
+
+    static constexpr uint64_t TAG_NIL = 1;
+    static constexpr uint64_t TAG_FALSE = 2;
+    static constexpr uint64_t TAG_TRUE = 3;
+
+    uint64_t m_bits;
+#else
     ValueType m_type;
 
     union {
@@ -23,6 +42,9 @@ class Value {
         bool asBool;
         Object* asObject;
     } m_value;
+#endif
+
+    ValueType getValueType() const;
 
 public:
     explicit Value(int value);
@@ -53,4 +75,121 @@ public:
 
 std::ostream& operator<<(std::ostream& stream, const Value& value);
 
+// These are called for almost every instruction the VM executes, so they are defined inline.
+
+#ifdef ENACT_NAN_BOXING_ENABLED
+
+static_assert(sizeof(double) == sizeof(uint64_t), "Value: NaN boxing requires 64-bit doubles.");
+static_assert(sizeof(Object*) <= sizeof(uint64_t), "Value: NaN boxing requires pointers of at most 64 bits.");
+
+inline Value::Value(int value) : m_bits{QNAN | INT_TAG | static_cast<uint32_t>(value)} {}
+
+inline Value::Value(double value) : m_bits{} {
+    std::memcpy(&m_bits, &value, sizeof(double));
+}
+
+inline Value::Value(bool value) : m_bits{QNAN | (value ? TAG_TRUE : TAG_FALSE)} {}
+inline Value::Value(Object* value) : m_bits{SIGN_BIT | QNAN | reinterpret_cast<uintptr_t>(value)} {}
+inline Value::Value() : m_bits{QNAN | TAG_NIL} {}
+
+inline bool Value::isInt() const {
+    return (m_bits & (SIGN_BIT | QNAN | INT_TAG)) == (QNAN | INT_TAG);
+}
+
+inline bool Value::isDouble() const {
+    return (m_bits & QNAN) != QNAN;
+}
+
+inline bool Value::isBool() const {
+    return (m_bits | 1) == (QNAN | TAG_TRUE);
+}
+
+inline bool Value::isObject() const {
+    return (m_bits & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN);
+}
+
+inline bool Value::isNil() const {
+    return m_bits == (QNAN | TAG_NIL);
+}
+
+inline int Value::asInt() const {
+    return static_cast<int>(static_cast<uint32_t>(m_bits));
+}
+
+inline double Value::asDouble() const {
+    double value;
+    std::memcpy(&value, &m_bits, sizeof(double));
+    return value;
+}
+
+inline bool Value::asBool() const {
+    return m_bits == (QNAN | TAG_TRUE);
+}
+
+inline Object* Value::asObject() const {
+    return reinterpret_cast<Object*>(static_cast<uintptr_t>(m_bits & ~(SIGN_BIT | QNAN)));
+}
+
+inline ValueType Value::getValueType() const {
+    if (isDouble()) return ValueType::DOUBLE;
+    if (isObject()) return ValueType::OBJECT;
+    if (isInt()) return ValueType::INT;
+    if (isBool()) return ValueType::BOOL;
+    return ValueType::NIL;
+}
+
+#else
+
+inline Value::Value(int value) : m_type{ValueType::INT}, m_value{.asInt = value} {}
+inline Value::Value(double value) : m_type{ValueType::DOUBLE}, m_value{.asDouble = value} {}
+inline Value::Value(bool value) : m_type{ValueType::BOOL}, m_value{.asBool = value} {}
+inline Value::Value(Object* value) : m_type{ValueType::OBJECT}, m_value{.asObject = value} {}
+inline Value::Value() : m_type{ValueType::NIL}, m_value{.asInt = 0} {}
+
+inline bool Value::isInt() const {
+    return m_type == ValueType::INT;
+}
+
+inline bool Value::isDouble() const {
+    return m_type == ValueType::DOUBLE;
+}
+
+inline bool Value::isBool() const {
+    return m_type == ValueType::BOOL;
+}
+
+inline bool Value::isObject() const {
+    return m_type == ValueType::OBJECT;
+}
+
+inline bool Value::isNil() const {
+    return m_type == ValueType::NIL;
+}
+
+inline int Value::asInt() const {
+    return m_value.asInt;
+}
+
+inline double Value::asDouble() const {
+    return m_value.asDouble;
+}
+
+inline bool Value::asBool() const {
+    return m_value.asBool;
+}
+
+inline Object* Value::asObject() const {
+    return m_value.asObject;
+}
+
+inline ValueType Value::getValueType() const {
+    return m_type;
+}
+
+#endif
+
+inline bool Value::is(ValueType type) const {
+    return getValueType() == type;
+}
+
 #endif //ENACT_VALUE_H
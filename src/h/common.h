@@ -11,6 +11,26 @@
 #define DEBUG_ASSERTIONS_ENABLED
 #endif
 
+// Threaded dispatch relies on the labels-as-values extension, which only GCC and Clang support.
+#if defined(ENACT_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define ENACT_COMPUTED_GOTO_ENABLED
+#endif
+
+// NaN boxing packs an Object* into the low 48 bits of a double, so it needs 64-bit pointers.
+#if defined(ENACT_NAN_BOXING) && UINTPTR_MAX == UINT64_MAX
+#define ENACT_NAN_BOXING_ENABLED
+#endif
+
+// The array kernels use x86 vector intrinsics, and GCC and Clang builtins to pick between them at runtime.
+#if defined(ENACT_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ENACT_SIMD_ENABLED
+#endif
+
+// The sampling profiler is driven by setitimer and SIGPROF, which only POSIX systems have.
+#if defined(__unix__) || defined(__APPLE__)
+#define ENACT_SAMPLING_ENABLED
+#endif
+
 #ifdef DEBUG_ASSERTIONS_ENABLED
 #define ENACT_ASSERT(expr, msg) \
         _enactAssert(expr, #expr, msg, __FILE__, __LINE__)
@@ -30,7 +50,7 @@ inline void _enactAssert(bool expr, std::string exprString, std::string msg, std
 #define ENACT_ABORT(msg) \
         _enactAbort(msg, __FILE__, __LINE__)
 
-inline void _enactAbort(std::string msg, std::string file, int line) {
+[[noreturn]] inline void _enactAbort(std::string msg, std::string file, int line) {
     std::cerr << "Aborted:    " << msg << "\n"
               << "Source:        " << file << ", line " << line << "\n";
     abort();